@@ -22,8 +22,11 @@
 #pragma once
 #include <triqs/utility/first_include.hpp>
 #include <triqs/utility/exceptions.hpp>
+#include <algorithm>
+#include <functional>
 #include <limits>
 #include <iostream>
+#include <memory>
 #include <stack>
 #include <vector>
 #include "./rbt_iterators.hpp"
@@ -35,11 +38,13 @@ namespace triqs {
 
     // Key: must be a regular type, ie. with comparison operators
     // Value: semi-regular type, wth a reset method void reset (T&&...)
+    //        Optionally, data on the subtree of the node (e.g. counts), recomputed from the children by
+    //        void update_subtree(Value const *left, Value const *right), null for no child
     // Compare: compare operator for the Keys
     template <typename Key, typename Value, typename Compare = std::less<Key>> class rb_tree {
 
-      static const bool RED   = true;
-      static const bool BLACK = false;
+      static constexpr bool RED   = true;
+      static constexpr bool BLACK = false;
       Compare compare;
 
       public:
@@ -57,15 +62,13 @@ namespace triqs {
         node_t(Key const &key, Value const &val, bool color, int N)
            : Value(val), key(key), color(color), N(N), left{nullptr}, right{nullptr}, modified(true), delete_flag(false) {}
 
-        node_t(node_t const &n)
-           : Value(n),
-             key(n.key),
-             color(n.color),
-             N(n.N),
-             left(n.left ? new node_t(*n.left) : nullptr),
-             right(n.right ? new node_t(*n.right) : nullptr),
-             modified(n.modified),
-             delete_flag(n.delete_flag) {}
+        node_t(Key const &key, Value &&val, bool color, int N)
+           : Value(std::move(val)), key(key), color(color), N(N), left{nullptr}, right{nullptr}, modified(true), delete_flag(false) {}
+
+        // Nodes are owned by the pool of the tree: no copy, the move is used for the relocation of the nodes
+        node_t(node_t const &) = delete;
+        node_t(node_t &&n) noexcept
+           : Value(std::move(n)), key(n.key), color(n.color), N(n.N), left(n.left), right(n.right), modified(n.modified), delete_flag(n.delete_flag) {}
         node_t &operator=(node_t const &) = delete;
         template <typename... T> void reset(Key const &k, T &&... x) {
           key   = k;
@@ -120,11 +123,134 @@ namespace triqs {
         return x->N;
       }
 
+      // recompute the subtree count, and the subtree data of the Value if any, from the children of h
+      static constexpr bool has_subtree_data = requires(Value &v, Value const *c) { v.update_subtree(c, c); };
+      void update_subtree(node h) {
+        h->N = size(h->left) + size(h->right) + 1;
+        if constexpr (has_subtree_data) h->update_subtree(h->left, h->right);
+      }
+
       void rec_free(node n) {
         if (n == nullptr) return;
         rec_free(n->left);
         rec_free(n->right);
-        delete n;
+        destroy_node(n);
+      }
+
+      /*************************************************************************
+  *  Node pool
+     -- nodes are constructed in slabs of raw storage, instead of one heap allocation per node
+     -- deleted nodes are kept (constructed) in a free list and recycled by the next insertions,
+        so that the storage held by their Value (e.g. a cache) survives a delete/insert cycle
+ *************************************************************************/
+
+      struct slab_t {
+        node_t *mem;  // raw storage
+        int capacity; // number of nodes in the slab
+        int n_alive;  // number of constructed nodes in the slab
+      };
+      std::vector<slab_t> slabs;
+      std::vector<node_t *> raw_slots; // storage not holding a constructed node
+      std::vector<node> free_nodes;    // constructed, detached nodes, ready for reuse
+      int n_constructed = 0;           // number of constructed nodes in all slabs
+
+      node_t *allocate_slab(int capacity) {
+        node_t *mem = std::allocator<node_t>{}.allocate(capacity);
+        slabs.push_back({mem, capacity, 0});
+        return mem;
+      }
+
+      slab_t &slab_of(node_t const *p) {
+        auto lt = std::less<node_t const *>{};
+        auto it = std::find_if(slabs.begin(), slabs.end(), [&](slab_t const &s) { return !lt(p, s.mem) && lt(p, s.mem + s.capacity); });
+        if (it == slabs.end()) TRIQS_RUNTIME_ERROR << "rbt: node not allocated by the pool of this tree";
+        return *it;
+      }
+
+      // a new slab holds as many nodes as are constructed : the storage grows geometrically, in proportion to the live nodes
+      node_t *get_raw_slot() {
+        if (raw_slots.empty()) {
+          int capacity = std::max(16, n_constructed);
+          node_t *mem  = allocate_slab(capacity);
+          for (int i = capacity - 1; i >= 0; --i) raw_slots.push_back(mem + i); // use the slab in increasing address order
+        }
+        node_t *p = raw_slots.back();
+        raw_slots.pop_back();
+        return p;
+      }
+
+      template <typename... T> node construct_node(T &&... x) {
+        node n = new (get_raw_slot()) node_t(std::forward<T>(x)...);
+        slab_of(n).n_alive++;
+        n_constructed++;
+        return n;
+      }
+
+      void destroy_node(node n) {
+        n->~node_t();
+        slab_of(n).n_alive--;
+        n_constructed--;
+        raw_slots.push_back(n);
+      }
+
+      // reinitialize the links and flags of a node taken from the free list
+      static node prepare_recycled_node(node n, Key const &key) {
+        n->key         = key;
+        n->color       = RED;
+        n->N           = 1;
+        n->left        = nullptr;
+        n->right       = nullptr;
+        n->modified    = true;
+        n->delete_flag = false;
+        return n;
+      }
+
+      // a new red node with value val: recycled if possible
+      node acquire_node(Key const &key, Value const &val) {
+        if (free_nodes.empty()) return construct_node(key, val, RED, 1);
+        node n = free_nodes.back();
+        free_nodes.pop_back();
+        n->Value::operator=(val);
+        return prepare_recycled_node(n, key);
+      }
+
+      // a new red node with value Value(x...): recycled with Value::reset(x...) if possible
+      template <typename... T> node acquire_node_reset(Key const &key, T &&... x) {
+        if (free_nodes.empty()) return construct_node(key, Value(std::forward<T>(x)...), RED, 1);
+        node n = free_nodes.back();
+        free_nodes.pop_back();
+        n->Value::reset(std::forward<T>(x)...);
+        return prepare_recycled_node(n, key);
+      }
+
+      // deep copy of the subtree rooted at x, with nodes from the pool
+      node clone(node x) {
+        if (x == nullptr) return nullptr;
+        node y        = construct_node(x->key, static_cast<Value const &>(*x), x->color, x->N);
+        y->modified    = x->modified;
+        y->delete_flag = x->delete_flag;
+        y->left        = clone(x->left);
+        y->right       = clone(x->right);
+        return y;
+      }
+
+      // move node n into the raw storage at slot
+      node relocate_one(node n, node_t *slot) {
+        node m = new (slot) node_t(std::move(*n));
+        slab_of(m).n_alive++;
+        n_constructed++;
+        destroy_node(n);
+        return m;
+      }
+
+      // move the subtree rooted at n into consecutive storage, in traversal (increasing key) order
+      node relocate(node n, node_t *&slot) {
+        if (n == nullptr) return nullptr;
+        node l   = relocate(n->left, slot);
+        node m   = relocate_one(n, slot++);
+        m->left  = l;
+        m->right = relocate(m->right, slot);
+        return m;
       }
 
       /*************************************************************************
@@ -159,11 +285,43 @@ namespace triqs {
       template <typename Fnt> friend void foreach_subtree_first(rb_tree const &tr, Fnt const &f) { foreach_subtree_first(tr, tr.root, f); }
 
       rb_tree() : root(nullptr) {}
-      ~rb_tree() { rec_free(root); }
-      //rb_tree(rb_tree const& n) =delete;
+      ~rb_tree() {
+        rec_free(root);
+        for (auto n : free_nodes) destroy_node(n);
+        // nodes still detached from the tree (cf make_node) are not destroyed, they should have been released
+        for (auto &s : slabs) std::allocator<node_t>{}.deallocate(s.mem, s.capacity);
+      }
       // not tested enough
-      rb_tree(rb_tree const &n) : compare(n.compare) {
-        if (n.root) root = new node_t(*n.root);
+      rb_tree(rb_tree const &n) : compare(n.compare), root(nullptr) { root = clone(n.root); }
+      rb_tree &operator=(rb_tree const &) = delete;
+
+      /*************************************************************************
+  *  Pool management
+  *************************************************************************/
+
+      /// A detached node with value Value(x...), taken from the pool of the tree. Give it back with release_node.
+      template <typename... T> node make_node(Key const &key, T &&... x) { return acquire_node_reset(key, std::forward<T>(x)...); }
+
+      /// Give back a detached node to the pool. Its value is kept for later reuse.
+      void release_node(node n) { free_nodes.push_back(n); }
+
+      /// Number of nodes ready for reuse in the pool
+      int pool_size() const { return free_nodes.size(); }
+
+      /// Relocate the nodes of the tree (and the free nodes) into contiguous storage, in the order of increasing keys.
+      /// Detached nodes are left in place. Invalidates all pointers to the nodes of the tree.
+      void compact() {
+        int n_nodes = size() + free_nodes.size();
+        if (n_nodes == 0) return;
+        node_t *slot = allocate_slab(n_nodes);
+        root         = relocate(root, slot);
+        for (auto &n : free_nodes) n = relocate_one(n, slot++);
+        // deallocate the slabs which do not hold any constructed node any more
+        auto is_dead = [](slab_t const &s) { return s.n_alive == 0; };
+        std::erase_if(raw_slots, [this, &is_dead](node_t *p) { return is_dead(slab_of(p)); });
+        for (auto &s : slabs)
+          if (is_dead(s)) std::allocator<node_t>{}.deallocate(s.mem, s.capacity);
+        std::erase_if(slabs, is_dead);
       }
 
       /// Number of nodes in the tree
@@ -331,21 +489,34 @@ namespace triqs {
       public:
       // insert the key-value pair; overwrite the old value with the new value
       // if the key is already present
-      void insert(Key const &key, Value const &val) {
-        root        = insert(root, key, val);
+      void insert(Key const &key, Value const &val) { insert_node(acquire_node(key, val)); }
+
+      // insert the key with the value Value(x...). A recycled node is reset with Value::reset(x...)
+      template <typename... T> void emplace(Key const &key, T &&... x) { insert_node(acquire_node_reset(key, std::forward<T>(x)...)); }
+
+      private:
+      void insert_node(node x) {
+        try {
+          root = insert_impl(root, x);
+        } catch (rbt_insert_error const &) {
+          release_node(x);
+          throw;
+        }
         root->color = BLACK;
         check();
       }
 
-      private:
-      // insert the key-value pair in the subtree rooted at h
-      node insert(node h, Key const &key, Value const &val) {
-        if (h == nullptr) return new node_t(key, val, true, 1);
-
-        if (compare(key, h->key))
-          h->left = insert(h->left, key, val);
-        else if (compare(h->key, key))
-          h->right = insert(h->right, key, val);
+      // insert the (red, detached) node x in the subtree rooted at h
+      node insert_impl(node h, node x) {
+        if (h == nullptr) {
+          update_subtree(x);
+          return x;
+        }
+
+        if (compare(x->key, h->key))
+          h->left = insert_impl(h->left, x);
+        else if (compare(h->key, x->key))
+          h->right = insert_impl(h->right, x);
         else
           throw rbt_insert_error{};
 
@@ -353,7 +524,7 @@ namespace triqs {
         if (is_red(h->right) && !is_red(h->left)) h     = rotateLeft(h);
         if (is_red(h->left) && is_red(h->left->left)) h = rotateRight(h);
         if (is_red(h->left) && is_red(h->right)) flipColors(h);
-        h->N = size(h->left) + size(h->right) + 1;
+        update_subtree(h);
 
         h->modified = true;
         return h;
@@ -366,7 +537,7 @@ namespace triqs {
       // delete the key-value pair with the minimum key rooted at h
       node deleteMin(node h) {
         if (h->left == nullptr) {
-          delete h;
+          release_node(h);
           return nullptr;
         }
         if (!is_red(h->left) && !is_red(h->left->left)) h = moveRedLeft(h);
@@ -379,7 +550,7 @@ namespace triqs {
         if (is_red(h->left)) h = rotateRight(h);
         if (h->right == nullptr) {
           // std::cout << " deleting " << h->key << std::endl;
-          delete h;
+          release_node(h);
           return nullptr;
         }
         if (!is_red(h->right) && !is_red(h->right->left)) h = moveRedRight(h);
@@ -430,14 +601,16 @@ namespace triqs {
 
           if (is_red(h->left)) h = rotateRight(h);
           if (key == h->key && (h->right == nullptr)) {
-            delete h;
+            release_node(h);
             return nullptr;
           }
           if (!is_red(h->right) && !is_red(h->right->left)) h = moveRedRight(h);
           if (key == h->key) {
-            node x            = min(h->right);
-            h->key            = x->key;
-            h->Value::operator=(*x);
+            node x = min(h->right);
+            h->key = x->key;
+            // exchange rather than copy the values: x is recycled with the old value of h, no copy of its storage
+            using std::swap;
+            swap(static_cast<Value &>(*h), static_cast<Value &>(*x));
             h->modified       = true;  // not sure it is needed
             h->delete_flag    = false; // CRUCIAL!
             h->right          = deleteMin(h->right);
@@ -460,8 +633,8 @@ namespace triqs {
         x->right        = h;
         x->color        = x->right->color;
         x->right->color = RED;
-        x->N            = h->N;
-        h->N            = size(h->left) + size(h->right) + 1;
+        update_subtree(h);
+        update_subtree(x);
         h->modified     = true;
         x->modified     = true;
         return x;
@@ -475,8 +648,8 @@ namespace triqs {
         x->left        = h;
         x->color       = x->left->color;
         x->left->color = RED;
-        x->N           = h->N;
-        h->N           = size(h->left) + size(h->right) + 1;
+        update_subtree(h);
+        update_subtree(x);
         h->modified    = true;
         x->modified    = true;
         return x;
@@ -524,7 +697,7 @@ namespace triqs {
         if (is_red(h->left) && is_red(h->left->left)) h = rotateRight(h);
         if (is_red(h->left) && is_red(h->right)) flipColors(h);
 
-        h->N        = size(h->left) + size(h->right) + 1;
+        update_subtree(h);
         h->modified = true;
         return h;
       }
@@ -648,6 +821,41 @@ namespace triqs {
           return x;
       }
 
+      public:
+      /// The node of rank n among the nodes x with match(x), in the order of the keys. nullptr if there are fewer.
+      /// count(x) : the number of such nodes in the subtree rooted at x (not null), e.g. kept by Value::update_subtree. O(log N).
+      template <typename Count, typename Match> node select_if(int n, Count const &count, Match const &match) const {
+        node x = root;
+        while (x != nullptr) {
+          int l = (x->left ? count(x->left) : 0);
+          if (n < l)
+            x = x->left;
+          else {
+            n -= l;
+            if (match(x) && (n-- == 0)) return x;
+            x = x->right;
+          }
+        }
+        return nullptr;
+      }
+
+      public:
+      /// Calls f(x, true) for whole subtrees rooted at x and f(x, false) for single nodes x, which together are the nodes with keys
+      /// less than key. O(log N) calls.
+      template <typename F> void visit_less_than(Key const &key, F const &f) const {
+        node x = root;
+        while (x != nullptr) {
+          if (compare(key, x->key))
+            x = x->left;
+          else {
+            if (x->left) f(x->left, true);
+            if (!compare(x->key, key)) return; // x->key == key
+            f(x, false);
+            x = x->right;
+          }
+        }
+      }
+
       public:
       /// Number of keys less than key
       int rank(Key const &key) const { return rank(key, root); }
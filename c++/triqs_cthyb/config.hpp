@@ -59,9 +59,11 @@ using delta_target_t = matrix_real_valued;
 
 #ifdef LOCAL_HAMILTONIAN_IS_COMPLEX
 using h_scalar_t = dcomplex; // type of scalar for H_loc: double or complex.
+using h_scalar_float_t = std::complex<float>; // single precision h_scalar_t
 static constexpr bool is_h_scalar_complex = true;
 #else
 using h_scalar_t = double; // type of scalar for H_loc: double or complex.
+using h_scalar_float_t = float; // single precision h_scalar_t
 static constexpr bool is_h_scalar_complex = false;
 #endif
 
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include "./configuration.hpp"
+#include <iterator>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  // The parity of the permutation bringing the operators of the configuration to
+  // d^_1 d^_1 d^_1 ... d_1 d_1 d_1   d^_2 d^_2 ... d_2 d_2   ...   d^_n .. d_n
+
+  // An operator added to or removed from the configuration by a move
+  struct changed_op_t {
+    time_pt tau;
+    int block_index;
+    bool dagger;
+  };
+
+  // The parity, from the whole configuration (time_pt -> op_desc, in decreasing time). O(n x n_blocks)
+  template <typename Config> int compute_config_parity(Config const &config, int n_blocks) {
+
+    int s = 0;
+    std::vector<int> n_op_with_a_equal_to(n_blocks, 0), n_ndag_op_with_a_equal_to(n_blocks, 0);
+
+    // loop over the operators "op" in the trace (right to left)
+    for (auto const &op : config) {
+
+      // how many operators with an 'a' larger than "op" are there on the left of "op"?
+      for (int a = op.second.block_index + 1; a < n_blocks; ++a) s += n_op_with_a_equal_to[a];
+      n_op_with_a_equal_to[op.second.block_index]++;
+
+      // if "op" is not a dagger how many operators of the same a but with a dagger are there on his right?
+      if (op.second.dagger)
+        s += n_ndag_op_with_a_equal_to[op.second.block_index];
+      else
+        n_ndag_op_with_a_equal_to[op.second.block_index]++;
+    }
+    return s % 2;
+  }
+
+  // The change of the parity by a move which added or removed the changed operators, once the trace is confirmed.
+  // A pair of operators contributes to the parity independently of the others : only the pairs with a changed operator
+  // are counted, from the numbers of operators of each kind above and below it in the trace tree (count_operators).
+  // n_op_above and n_op_total are workspaces. O(|changed| x (log n + n_blocks))
+  template <typename Trace, typename Changed>
+  int config_parity_change(Trace const &imp_trace, Changed const &changed, std::vector<int> &n_op_above, std::vector<int> &n_op_total) {
+
+    // is the pair (x, y), x at a later time than y, out of order ?
+    auto out_of_order = [](changed_op_t const &x, changed_op_t const &y) {
+      return (x.block_index > y.block_index) || (x.block_index == y.block_index && !x.dagger && y.dagger);
+    };
+
+    int s = 0;
+    for (auto const &x : changed) {
+      imp_trace.count_operators(x.tau, n_op_above, n_op_total);
+      for (int k = 0; k < int(n_op_total.size()); ++k) {
+        changed_op_t y{x.tau, k / 2, bool(k % 2)};
+        if (out_of_order(y, x)) s += n_op_above[k];
+        if (out_of_order(x, y)) s += n_op_total[k] - n_op_above[k];
+      }
+    }
+    // the pairs of changed operators are counted twice above if they are in the tree, not at all if they are not
+    for (auto x = changed.begin(); x != changed.end(); ++x)
+      for (auto y = std::next(x); y != changed.end(); ++y) s += (x->tau > y->tau ? out_of_order(*x, *y) : out_of_order(*y, *x));
+
+    return s % 2;
+  }
+
+} // namespace triqs_cthyb
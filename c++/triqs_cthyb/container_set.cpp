@@ -33,6 +33,8 @@ namespace triqs_cthyb {
     h5_write(grp, "asymmetry_G_tau", c.asymmetry_G_tau);
     h5_write(grp, "G_l", c.G_l);
     h5_write(grp, "O_tau", c.O_tau);
+    h5_write(grp, "O_tau_matrix", c.O_tau_matrix);
+    h5_write(grp, "chi_static", c.chi_static);
     h5_write(grp, "perturbation_order", c.perturbation_order);
     h5_write(grp, "perturbation_order_total", c.perturbation_order_total);
 
@@ -57,6 +59,8 @@ namespace triqs_cthyb {
     h5_read(grp, "asymmetry_G_tau", c.asymmetry_G_tau);
     h5_read(grp, "G_l", c.G_l);
     h5_try_read(grp, "O_tau", c.O_tau);
+    h5_try_read(grp, "O_tau_matrix", c.O_tau_matrix);
+    h5_try_read(grp, "chi_static", c.chi_static);
     h5_try_read(grp, "perturbation_order", c.perturbation_order);
     h5_try_read(grp, "perturbation_order_total", c.perturbation_order_total);
 
@@ -47,6 +47,12 @@ namespace triqs_cthyb {
     /// General operator Green's function :math:`O(\tau)` in imaginary time.
     std::optional<gf<imtime, scalar_valued>> O_tau;
 
+    /// Matrix of the operator Green's functions :math:`O_{ab}(\tau) = \langle O_a(\tau) O_b(0) \rangle` in imaginary time.
+    std::optional<gf<imtime, matrix_valued>> O_tau_matrix;
+
+    /// Static susceptibilities :math:`\chi_{ab} = \int_0^\beta d\tau \langle O_a(\tau) O_b(0) \rangle`.
+    std::optional<matrix<dcomplex>> chi_static;
+
     // -- Two-particle Green's functions
 
     /// Two-particle Green's function :math:`G^{(2)}(\tau_1,\tau_2,\tau_3)` (three Fermionic imaginary times)
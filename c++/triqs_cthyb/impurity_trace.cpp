@@ -20,7 +20,9 @@
  ******************************************************************************/
 #include "impurity_trace.hpp"
 #include <nda/nda.hpp>
+#include <nda/blas.hpp>
 #include <algorithm>
+#include <tuple>
 #include <limits>
 
 //#define CHECK_ALL
@@ -31,17 +33,29 @@
 #endif
 
 double double_max = std::numeric_limits<double>::max(); // easier to read
-
-template <typename T>
-// require( is_real_or_complex<T>) FIXME?
-double frobenius_norm2(nda::matrix<T> const &a) {
-  double r = 0;
-  for (int i = 0; i < a.shape()[0]; ++i)
+double double_inf = std::numeric_limits<double>::infinity();
+
+// Bound of the spectral norm of a : min(Frobenius norm, sqrt(largest column sum x largest row sum)).
+// Returns {-ln(bound), ln(Frobenius norm / bound) >= 0}
+template <typename M> std::pair<double, double> spectral_lnorm_bound(M const &a) {
+  double f2 = 0, row_max = 0, col_max = 0;
+  for (int i = 0; i < a.shape()[0]; ++i) {
+    double r = 0;
     for (int j = 0; j < a.shape()[1]; ++j) {
       auto ab = std::abs(a(i, j));
-      r += ab * ab;
+      r += ab;
+      f2 += ab * ab;
     }
-  return std::sqrt(r);
+    row_max = std::max(row_max, r);
+  }
+  for (int j = 0; j < a.shape()[1]; ++j) {
+    double c = 0;
+    for (int i = 0; i < a.shape()[0]; ++i) c += std::abs(a(i, j));
+    col_max = std::max(col_max, c);
+  }
+  double f = std::sqrt(f2), s = std::min(f, std::sqrt(row_max * col_max));
+  if (!(s > 0)) return {double_max, 0};
+  return {-std::log(s), std::log(f / s)};
 }
 
 // -----------------------------------------------
@@ -50,10 +64,14 @@ namespace triqs_cthyb {
 
   // -------- Constructor --------
   impurity_trace::impurity_trace(double beta, atom_diag const &h_diag_, histo_map_t *hist_map, bool use_norm_as_weight, bool measure_density_matrix,
-                                 bool performance_analysis)
+                                 bool performance_analysis, int n_threads, bool use_trace_estimator, bool use_state_propagation,
+                                 double state_propagation_cutoff, bool use_float_estimates)
      : beta(beta),
        use_norm_as_weight(use_norm_as_weight),
        measure_density_matrix(measure_density_matrix),
+       use_trace_estimator(use_trace_estimator),
+       use_state_propagation(use_state_propagation),
+       use_float_estimates(use_float_estimates),
        h_diag(&h_diag_),
        density_matrix(n_blocks),
        atomic_rho(n_blocks),
@@ -61,6 +79,61 @@ namespace triqs_cthyb {
        atomic_norm(0),
        histo(performance_analysis ? new histograms_t(h_diag_.n_subspaces(), *hist_map) : nullptr) {
 
+    // threads for the evaluation of the blocks
+    if (n_threads < 1) TRIQS_RUNTIME_ERROR << "impurity_trace: the number of threads must be >= 1, got " << n_threads;
+    if (n_threads > 1) pool = std::make_unique<thread_pool>(n_threads);
+    workspaces.resize(n_threads);
+    trial_matrices.resize(n_threads);
+    block_results.resize(n_threads);
+
+    // The estimate must be a function of the configuration only : the order of the blocks can not depend
+    // on the matrices which happen to be in the cache, so the bounds are not improved with their norms.
+    if (use_trace_estimator) {
+      if (use_norm_as_weight) TRIQS_RUNTIME_ERROR << "impurity_trace: use_trace_estimator and use_norm_as_weight can not be used together";
+      use_norm_of_matrices_in_cache = false;
+    }
+
+    // the estimates bound the trace, not the norm, and need the cached matrices
+    if (use_float_estimates && (use_norm_as_weight || use_state_propagation))
+      TRIQS_RUNTIME_ERROR << "impurity_trace: use_float_estimates can not be used with use_norm_as_weight or use_state_propagation";
+
+    // eigenvalues, flattened
+    for (int bl = 0; bl < n_blocks; ++bl) {
+      block_offsets.push_back(eigenvalues.size());
+      for (int u = 0; u < get_block_dim(bl); ++u) eigenvalues.push_back(get_block_eigenval(bl, u));
+    }
+    int max_dim = 0;
+    for (int bl = 0; bl < n_blocks; ++bl) max_dim = std::max(max_dim, get_block_dim(bl));
+    ones.assign(max_dim, 1.0);
+
+    // the states kept by the propagation : exp(-beta (E - E_0)) > state_propagation_cutoff
+    if (use_state_propagation) {
+      if (use_norm_as_weight) TRIQS_RUNTIME_ERROR << "impurity_trace: use_state_propagation and use_norm_as_weight can not be used together";
+      double e0 = get_block_emin(0);
+      for (int bl = 1; bl < n_blocks; ++bl) e0 = std::min(e0, get_block_emin(bl));
+      double e_max = e0 - std::log(state_propagation_cutoff) / beta;
+      n_propagated_states.resize(n_blocks);
+      for (int bl = 0; bl < n_blocks; ++bl) {
+        int k = 0;
+        while (k < get_block_dim(bl) && get_block_eigenval(bl, k) < e_max) ++k;
+        n_propagated_states[bl] = k;
+      }
+      // the trace of the empty configuration, on the same states
+      atomic_z = 0;
+      for (int bl = 0; bl < n_blocks; ++bl)
+        for (int u = 0; u < n_propagated_states[bl]; ++u) atomic_z += std::exp(-beta * get_block_eigenval(bl, u));
+    }
+
+    // the connections and the sparse forms of the operators
+    for (int op = 0; op < n_orbitals; ++op) {
+      add_block_maps(c_block_maps, [&](int b) { return h_diag->c_connection(op, b); });
+      add_block_maps(cdag_block_maps, [&](int b) { return h_diag->cdag_connection(op, b); });
+      add_sparse_forms(
+         sparse_c, [&](int b) -> auto const & { return h_diag->c_matrix(op, b); }, [&](int b) { return h_diag->c_connection(op, b); });
+      add_sparse_forms(
+         sparse_cdag, [&](int b) -> auto const & { return h_diag->cdag_matrix(op, b); }, [&](int b) { return h_diag->cdag_connection(op, b); });
+    }
+
     // init density_matrix block + bool
     for (int bl = 0; bl < n_blocks; ++bl) density_matrix[bl] = bool_and_matrix{false, matrix_t(get_block_dim(bl), get_block_dim(bl))};
 
@@ -76,6 +149,9 @@ namespace triqs_cthyb {
       }
       atomic_norm = std::sqrt(atomic_norm);
     }
+
+    // the accepted configuration is empty
+    accepted_density_matrix = (use_norm_as_weight ? atomic_rho : density_matrix);
   }
 
   //====== Recursive operations ======
@@ -111,165 +187,522 @@ namespace triqs_cthyb {
 
     return (n->left ? compute_block_table(n->left, b2) : b2);
   }
-  // -------- Computation of the block table and bounds -------------
-
-  // for subtree at node n, return (B', bound)
-  // precondition: b !=-1, n != null
-  // returns -1 for structural and/or threshold cancellation
-  std::pair<int, double> impurity_trace::compute_block_table_and_bound(node n, int b, double lnorm_threshold, bool use_threshold) {
-
-    if (b < 0) TRIQS_RUNTIME_ERROR << " b < 0";
-    if (!n->modified) return {n->cache.block_table[b], n->cache.matrix_lnorms[b]};
-
-    double lnorm = 0;
+  // -------- Computation of the block tables and bounds -------------
+
+  // for subtree at node n, maps the blocks of bt to their images B' and adds the (spectral) bounds of the subtree.
+  // The blocks are kept in a flat table, and mapped all together through each operator.
+  // Blocks with structural cancellation are removed from bt.alive, and not considered further.
+  void impurity_trace::compute_block_tables_and_bounds(node n, block_batch_t &bt) {
+
+    if (bt.n_alive == 0) return;
+
+    if (!n->modified) {
+      auto const &bl = n->cache.block_table;
+      auto const &ln = n->cache.matrix_lnorms;
+      auto const &lx = n->cache.matrix_lexcess;
+      bt.for_each_alive([&](int i) {
+        int b = bt.blocks[i];
+        if (bl[b] < 0) return bt.kill(i);
+        bt.blocks[i] = bl[b];
+        bt.lnorms[i] += ln[b];
+        bt.lexcess[i] = std::min(bt.lexcess[i], lx[b]);
+      });
+      return;
+    }
 
-    int b1 = b;
     if (n->right) {
-      std::tie(b1, lnorm) = compute_block_table_and_bound(n->right, b, lnorm_threshold, use_threshold);
-      if (b1 < 0) return {b1, 0};
-      lnorm += n->cache.dtau_r * get_block_emin(b1);
+      compute_block_tables_and_bounds(n->right, bt);
+      double dtau_r = n->cache.dtau_r;
+      bt.for_each_alive([&](int i) { bt.lnorms[i] += dtau_r * get_block_emin(bt.blocks[i]); });
     }
-    if (use_threshold && (lnorm > lnorm_threshold)) return {-1, 0};
-
-    int b2 = (n->delete_flag ? b1 : get_op_block_map(n, b1));
-    if (b2 < 0) return {b2, 0};
 
-    int b3 = b2;
-    if (n->left) {
-      lnorm += n->cache.dtau_l * get_block_emin(b2);
-      if (use_threshold && (lnorm > lnorm_threshold)) return {-1, 0};
-      double lnorm3;
-      std::tie(b3, lnorm3) = compute_block_table_and_bound(n->left, b2, lnorm_threshold, use_threshold);
-      if (b3 < 0) return {b3, 0};
-      lnorm += lnorm3;
+    if (!n->delete_flag) {
+      auto const *map = get_op_block_maps(n);
+      bt.for_each_alive([&](int i) {
+        int b2 = map[bt.blocks[i]];
+        if (b2 < 0) return bt.kill(i);
+        bt.blocks[i] = b2;
+      });
     }
 
-    if (use_threshold && (lnorm > lnorm_threshold)) return {-1, 0};
-
-    if (std::isinf(lnorm)) {
-      lnorm = double_max;
-      if (lnorm < 0) TRIQS_RUNTIME_ERROR << "Negative lnorm in compute_block_table_and_bound!";
+    if (n->left) {
+      double dtau_l = n->cache.dtau_l;
+      bt.for_each_alive([&](int i) { bt.lnorms[i] += dtau_l * get_block_emin(bt.blocks[i]); });
+      compute_block_tables_and_bounds(n->left, bt);
     }
-
-    return {b3, lnorm};
   }
 
   // -------- Computation of the matrix ------------------------------
 
   // returns {block that b connects to at this node, matrix for this block on node n (if not structurally zero, i.e. if B' != -1)}
-  std::pair<int, matrix_t> impurity_trace::compute_matrix(node n, int b) {
+  // The matrix is a view, either on the cache of node n, or on the workspace of this depth (valid until the next call at this depth)
+  std::pair<int, nda::matrix_const_view<h_scalar_t>> impurity_trace::compute_matrix(node n, int b, int thread, int depth) {
 
     if (b == -1) return {-1, {}};
     if (n == nullptr) return {b, {}};
-    if (!n->modified && n->cache.matrix_norm_valid[b]) return {n->cache.block_table[b], n->cache.matrices[b]};
+    if (!n->modified && n->cache.matrix_norm_valid[b]) return {n->cache.block_table[b], get_cached_matrix(n, b)};
     bool updating = (!n->modified && !n->cache.matrix_norm_valid[b]);
 
-    double dtau_l = 0, dtau_r = 0;
-    auto _ = arrays::range();
+    auto &thread_workspaces = workspaces[thread];
+    if (int(thread_workspaces.size()) <= depth) thread_workspaces.resize(depth + 1);
+    auto &ws = thread_workspaces[depth];
+    int cur  = 0; // the buffer of ws holding M
 
-    auto r = compute_matrix(n->right, b);
+    auto r = compute_matrix(n->right, b, thread, depth + 1);
     int b1 = r.first; // exit block of right subtree
     if (b1 == -1) return {-1, {}};
 
     int b2 = (n->delete_flag ? b1 : get_op_block_map(n, b1)); // relevant block on current node
     if (b2 == -1) return {-1, {}};
 
-    matrix_t M = (!n->delete_flag ? get_op_block_matrix(n, b1) : nda::eye<h_scalar_t>(get_block_dim(b1)));
-
-    if (n->right) { // M <- M * exp * r[b]
-      dtau_r   = double(n->key - tree.min_key(n->right));
-      auto dim = M.shape()[1];                                                               // same as get_block_dim(b2);
-      for (int i = 0; i < dim; ++i) M(_, i) *= std::exp(-dtau_r * get_block_eigenval(b1, i)); // Create time-evolution matrix e^-H(t'-t)
-      if ((r.second.shape()[0] == 1) && (r.second.shape()[1] == 1))
-        M *= r.second(0, 0);
-      else
-        M = M * r.second; // FIXME could try to optimise lapack call?
+    // M <- exp_l * op * exp_r : the time-evolution matrices e^-H(t'-t) to the left and right subtrees are diagonal,
+    // applied while copying the matrix of the operator. They are cached in the node as long as its dtau are unchanged.
+    // NB : the dtau of the modified nodes have been updated by update_dtau.
+    double const *er = (n->right ? get_evolution_factors(n->cache.exp_r, n->cache.dtau_r, b1) : ones.data());
+    double const *el = (n->left ? get_evolution_factors(n->cache.exp_l, n->cache.dtau_l, b2) : ones.data());
+    int d1 = get_block_dim(b1), d2 = get_block_dim(b2);
+    auto M = ws.matrix(cur, d2, d1);
+    auto sp = (n->delete_flag || !n->right ? nullptr : get_op_block_sparse(n, b1));
+    if (sp) { // M <- exp_l * op * exp_r * r[b], directly with the sparse form of op
+      M.rebind(ws.matrix(cur, d2, r.second.shape()[1]));
+      csr_gemm(*sp, el, er, r.second, M);
+    } else {
+      if (!n->delete_flag) {
+        auto const &op = get_op_block_matrix(n, b1);
+        for (int i = 0; i < d2; ++i)
+          for (int j = 0; j < d1; ++j) M(i, j) = el[i] * op(i, j) * er[j];
+      } else
+        for (int i = 0; i < d2; ++i)
+          for (int j = 0; j < d1; ++j) M(i, j) = (i == j ? el[i] * er[i] : 0);
+
+      if (n->right) { // M <- M * r[b]
+        if ((r.second.shape()[0] == 1) && (r.second.shape()[1] == 1))
+          M *= r.second(0, 0);
+        else {
+          auto P = ws.matrix(1 - cur, M.shape()[0], r.second.shape()[1]);
+          small_gemm(M, r.second, P);
+          M.rebind(P);
+          cur = 1 - cur;
+        }
+      }
     }
 
     int b3 = b2;
-    if (n->left) { // M <- l[b] * exp * M
-      auto l = compute_matrix(n->left, b2);
+    if (n->left) { // M <- l[b] * M
+      auto l = compute_matrix(n->left, b2, thread, depth + 1);
       b3     = l.first;
       if (b3 == -1) return {-1, {}};
-      dtau_l   = double(tree.max_key(n->left) - n->key);
-      auto dim = M.shape()[0]; // same as get_block_dim(b1);
-      for (int i = 0; i < dim; ++i) M(i, _) *= std::exp(-dtau_l * get_block_eigenval(b2, i));
       if ((l.second.shape()[0] == 1) && (l.second.shape()[1] == 1))
         M *= l.second(0, 0);
-      else
-        M = l.second * M;
+      else {
+        auto P = ws.matrix(1 - cur, l.second.shape()[0], M.shape()[1]);
+        small_gemm(l.second, M, P);
+        M.rebind(P);
+        cur = 1 - cur;
+      }
     }
 
     if (updating) {
-      n->cache.matrices[b]          = M;
-      n->cache.matrix_norm_valid[b] = true;
-
-      // improve the norm if calculating the full_trace
-      if (use_norm_of_matrices_in_cache) { // seems slower
-        auto norm = frobenius_norm(M);
-        if (std::abs(norm - frobenius_norm2(M)) > 1.e-12) TRIQS_RUNTIME_ERROR << " FROB PB" << M;
-        //if (norm < frobenius_norm2(M))  TRIQS_RUNTIME_ERROR << " FROB PB";
-        //if (norm < frobenius_norm2(M)) std::cout  <<norm <<" vs "<< frobenius_norm2(M)<<std::endl;// TRIQS_RUNTIME_ERROR << " FROB PB";
-        n->cache.matrix_lnorms[b] = -std::log(norm);
-        if (!isfinite(-std::log(norm))) { n->cache.matrix_lnorms[b] = double_max; }
-      }
+      store_in_cache(n, b, M);
+      return {b3, get_cached_matrix(n, b)};
     }
 
-    return {b3, std::move(M)};
+    keep_trial_matrix(n, b, b3, M, thread); // n is modified
+    return {b3, M};
+  }
+
+  // Put M in the cache of node n for block b
+  void impurity_trace::store_in_cache(node n, int b, nda::matrix_const_view<h_scalar_t> M) {
+    auto C                        = get_cached_matrix(n, b);
+    C                             = M;
+    n->cache.matrix_norm_valid[b] = true;
+
+    // improve the bound with the norm of the actual matrix
+    if (use_norm_of_matrices_in_cache) std::tie(n->cache.matrix_lnorms[b], n->cache.matrix_lexcess[b]) = spectral_lnorm_bound(C);
+  }
+
+  // ------- Matrices of the trial -----------------------
+
+  // Keep the matrix M of block b (-> b_out) of the modified node n, computed by the given thread
+  void impurity_trace::keep_trial_matrix(node n, int b, int b_out, nda::matrix_const_view<h_scalar_t> M, int thread) {
+    auto &t     = trial_matrices[thread];
+    long offset = t.buffer.size();
+    t.buffer.resize(offset + M.size());
+    nda::matrix_view<h_scalar_t>{M.shape(), t.buffer.data() + offset} = M;
+    t.matrices.push_back({n->cache.first_key, n->cache.last_key, b, b_out, thread, offset});
+  }
+
+  // After the update of the cache on confirmation : the modified nodes of the new tree take the matrices of the trial
+  // sub-trees with the same interval of keys.
+  // NB : a trial sub-tree bounded by a node flagged for deletion has no counterpart in the new tree, where this key is gone.
+  void impurity_trace::promote_trial_matrices() {
+
+    trial_matrices_sorted.clear();
+    for (auto const &t : trial_matrices) trial_matrices_sorted.insert(trial_matrices_sorted.end(), t.matrices.begin(), t.matrices.end());
+    if (trial_matrices_sorted.empty()) return;
+
+    auto key = [](trial_matrix_t const &x) { return std::tie(x.first_key, x.last_key, x.b); };
+    std::sort(trial_matrices_sorted.begin(), trial_matrices_sorted.end(), [&](auto const &x, auto const &y) { return key(x) < key(y); });
+
+    for (auto const &nodes : update_levels)
+      for (auto n : nodes) {
+        auto &c = n->cache;
+        auto it = std::lower_bound(trial_matrices_sorted.begin(), trial_matrices_sorted.end(), std::tie(c.first_key, c.last_key),
+                                   [](trial_matrix_t const &x, auto const &k) { return std::tie(x.first_key, x.last_key) < k; });
+        for (; it != trial_matrices_sorted.end() && it->first_key == c.first_key && it->last_key == c.last_key; ++it) {
+          if (c.matrix_norm_valid[it->b] || c.block_table[it->b] != it->b_out) continue;
+          auto const &buffer = trial_matrices[it->thread].buffer;
+          store_in_cache(n, it->b, nda::matrix_const_view<h_scalar_t>{std::array<long, 2>{get_block_dim(it->b_out), get_block_dim(it->b)},
+                                                                       buffer.data() + it->offset});
+        }
+      }
+    clear_trial_matrices();
+  }
+
+  // Visits the nodes as compute_matrix(n, b) does, and computes the evolution factors they will use.
+  // Called serially before the evaluation of several blocks in parallel, so that these evaluations only read the factors.
+  // Returns the block that b connects to, as compute_matrix.
+  int impurity_trace::prepare_evolution_factors(node n, int b) {
+
+    if (b == -1) return -1;
+    if (n == nullptr) return b;
+    if (!n->modified && n->cache.matrix_norm_valid[b]) return n->cache.block_table[b];
+
+    int b1 = prepare_evolution_factors(n->right, b);
+    if (b1 == -1) return -1;
+
+    int b2 = (n->delete_flag ? b1 : get_op_block_map(n, b1));
+    if (b2 == -1) return -1;
+
+    if (n->right) get_evolution_factors(n->cache.exp_r, n->cache.dtau_r, b1);
+    if (n->left) get_evolution_factors(n->cache.exp_l, n->cache.dtau_l, b2);
+
+    return prepare_evolution_factors(n->left, b2);
   }
 
   // ------- Update the cache -----------------------
 
-  void impurity_trace::update_cache() { update_cache_impl(tree.get_root()); }
+  // The modified nodes are updated level by level, from the leaves up : the update of a node only uses the caches of its children.
+  // With a thread pool and a large enough update (e.g. after a global move), the nodes of a level, and the blocks
+  // of each node, are updated in parallel.
 
-  // --------------------------------
+  void impurity_trace::update_cache() {
 
-  void impurity_trace::update_cache_impl(node n) {
+    // the trial is confirmed
+    dominant_block = trial_dominant_block;
+    std::swap(density_matrix, accepted_density_matrix);
 
-    if ((n == nullptr) || (!n->modified)) return;
-    if (n->delete_flag) TRIQS_RUNTIME_ERROR << " Internal Error: node flagged for deletion in cache update ";
-    update_cache_impl(n->left);
-    update_cache_impl(n->right);
-    n->cache.dtau_r = (n->right ? double(n->key - tree.min_key(n->right)) : 0);
-    n->cache.dtau_l = (n->left ? double(tree.max_key(n->left) - n->key) : 0);
-    for (int b = 0; b < n_blocks; ++b) {
-      auto r                        = compute_block_table_and_bound(n, b, double_max, false);
-      n->cache.block_table[b]       = r.first;
-      n->cache.matrix_lnorms[b]     = r.second;
-      n->cache.matrix_norm_valid[b] = false;
+    for (auto &l : update_levels) l.clear();
+    int n_levels = collect_modified_nodes(tree.get_root());
+
+    long n_nodes = 0;
+    for (int l = 0; l < n_levels; ++l) n_nodes += update_levels[l].size();
+    bool parallel = pool && (n_nodes * n_blocks >= parallel_update_cutoff);
+
+    for (int l = 0; l < n_levels; ++l) {
+      auto const &nodes = update_levels[l];
+      if (!parallel) {
+        for (auto n : nodes) update_cache_node(n, 0, n_blocks);
+        continue;
+      }
+      // Split the blocks of each node in chunks (of at least min_blocks_per_task), to have a task per thread at least
+      int n_nodes_l = nodes.size();
+      int n_chunks  = std::max(1, std::min((pool->size() + n_nodes_l - 1) / n_nodes_l, n_blocks / min_blocks_per_task));
+      int chunk     = (n_blocks + n_chunks - 1) / n_chunks;
+      pool->run(n_nodes_l * n_chunks, [&](int t, int) {
+        int c = t % n_chunks;
+        update_cache_node(nodes[t / n_chunks], c * chunk, std::min(n_blocks, (c + 1) * chunk));
+      });
     }
+
+    // The matrix storage of a node depends on all its blocks, hence a separate pass
+    if (parallel) {
+      for (int l = 0; l < n_levels; ++l) pool->run(update_levels[l].size(), [&](int i, int) { carve_matrix_buffer(update_levels[l][i]); });
+    } else {
+      for (int l = 0; l < n_levels; ++l)
+        for (auto n : update_levels[l]) carve_matrix_buffer(n);
+    }
+    promote_trial_matrices();
+
     // This is not necessary here as all modified nodes are "cleared"
     //  by tree::clear_modified in the try/cancel/confirm set
     // n->modified = false;
   }
 
+  // --------------------------------
+
+  // Put the modified nodes of the subtree in update_levels, by level : a node is one level above its highest modified child.
+  // Update their dtau. Returns the number of levels of the subtree.
+  int impurity_trace::collect_modified_nodes(node n) {
+
+    if ((n == nullptr) || (!n->modified)) return 0;
+    if (n->delete_flag) TRIQS_RUNTIME_ERROR << " Internal Error: node flagged for deletion in cache update ";
+    int l = std::max(collect_modified_nodes(n->left), collect_modified_nodes(n->right));
+    if (int(update_levels.size()) <= l) update_levels.resize(l + 1);
+    update_levels[l].push_back(n);
+    n->cache.dtau_r    = (n->right ? double(n->key - tree.min_key(n->right)) : 0);
+    n->cache.dtau_l    = (n->left ? double(tree.max_key(n->left) - n->key) : 0);
+    n->cache.first_key = tree.min_key(n);
+    n->cache.last_key  = tree.max_key(n);
+    return l + 1;
+  }
+
+  // --------------------------------
+
+  // Block table and bound of the blocks [b_begin, b_end) of node n, from the (already updated) caches of its children
+  // Same as compute_block_tables_and_bounds for the blocks [b_begin, b_end), without going down the modified subtrees again.
+  void impurity_trace::update_cache_node(node n, int b_begin, int b_end) {
+
+    auto &c = n->cache;
+    for (int b = b_begin; b < b_end; ++b) {
+      c.matrix_norm_valid[b] = false;
+      double lnorm = 0, lexcess = double_inf;
+
+      int b1 = b;
+      if (n->right) {
+        b1 = n->right->cache.block_table[b];
+        if (b1 < 0) {
+          c.block_table[b] = -1;
+          continue;
+        }
+        lnorm   = n->right->cache.matrix_lnorms[b] + c.dtau_r * get_block_emin(b1);
+        lexcess = n->right->cache.matrix_lexcess[b];
+      }
+
+      int b2 = get_op_block_map(n, b1);
+      if (b2 < 0) {
+        c.block_table[b] = -1;
+        continue;
+      }
+
+      int b3 = b2;
+      if (n->left) {
+        b3 = n->left->cache.block_table[b2];
+        if (b3 < 0) {
+          c.block_table[b] = -1;
+          continue;
+        }
+        lnorm += c.dtau_l * get_block_emin(b2) + n->left->cache.matrix_lnorms[b2];
+        lexcess = std::min(lexcess, n->left->cache.matrix_lexcess[b2]);
+      }
+
+      if (std::isinf(lnorm)) {
+        lnorm = double_max;
+        if (lnorm < 0) TRIQS_RUNTIME_ERROR << "Negative lnorm in update_cache_node!";
+      }
+      c.block_table[b]    = b3;
+      c.matrix_lnorms[b]  = lnorm;
+      c.matrix_lexcess[b] = lexcess;
+    }
+  }
+
+  // --------------------------------
+
+  // Carve the storage of the matrices of the structurally non-zero blocks, b -> block_table[b], from the matrix buffer
+  void impurity_trace::carve_matrix_buffer(node n) {
+    auto &c     = n->cache;
+    long offset = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      c.matrix_offset[b] = offset;
+      if (c.block_table[b] != -1 && !use_state_propagation) offset += long(get_block_dim(c.block_table[b])) * get_block_dim(b);
+    }
+    c.matrix_offset[n_blocks] = offset;
+    c.matrix_buffer.resize(offset); // keeps its capacity, no allocation in the long run for a recycled node
+  }
+
   // -------- Calculate the dtau for a given node to its left and right neighbours ----------------
   void impurity_trace::update_dtau(node n) {
     if ((n == nullptr) || (!n->modified)) return;
     update_dtau(n->left);
     update_dtau(n->right);
-    n->cache.dtau_r = (n->right ? double(n->key - tree.min_key(n->right)) : 0);
-    n->cache.dtau_l = (n->left ? double(tree.max_key(n->left) - n->key) : 0);
+    n->cache.dtau_r    = (n->right ? double(n->key - tree.min_key(n->right)) : 0);
+    n->cache.dtau_l    = (n->left ? double(tree.max_key(n->left) - n->key) : 0);
+    n->cache.first_key = tree.min_key(n);
+    n->cache.last_key  = tree.max_key(n);
+  }
+
+  // -------- Trace by propagation of states ----------------
+
+  // The nodes of the trial tree in increasing time (the tree is in reverse order), except the ones flagged for deletion
+  void impurity_trace::collect_propagation_path(node n) {
+    if (n == nullptr) return;
+    collect_propagation_path(n->right);
+    if (!n->delete_flag) propagation_path.push_back(n);
+    collect_propagation_path(n->left);
+  }
+
+  // Trace of block b on its n_propagated_states[b] lowest states.
+  // The states are the k columns of V, multiplied by the time evolutions and operators in turn :
+  // O(dim^2 k) per operator, instead of O(dim^3) for a product of block matrices.
+  h_scalar_t impurity_trace::propagate_states(int b, int thread) {
+    if (workspaces[thread].empty()) workspaces[thread].resize(1);
+    auto &ws = workspaces[thread][0];
+    int k = n_propagated_states[b], cur = 0, bc = b;
+    double t = 0;
+
+    auto V = ws.matrix(cur, get_block_dim(b), k);
+    for (int i = 0; i < V.shape()[0]; ++i)
+      for (int j = 0; j < k; ++j) V(i, j) = (i == j ? 1 : 0);
+
+    for (auto n : propagation_path) {
+      int b2 = get_op_block_map(n, bc);
+      if (b2 == -1) return 0;
+      // V <- op * exp(-(t_n - t) H) * V
+      double const *e = ws.exp(eigenvalues.data() + block_offsets[bc], double(n->key) - t, get_block_dim(bc));
+      for (int i = 0; i < V.shape()[0]; ++i)
+        for (int j = 0; j < k; ++j) V(i, j) *= e[i];
+      auto W = ws.matrix(1 - cur, get_block_dim(b2), k);
+      if (auto sp = get_op_block_sparse(n, bc))
+        csr_gemm(*sp, nullptr, nullptr, V, W);
+      else
+        small_gemm(get_op_block_matrix(n, bc), V, W);
+      V.rebind(W);
+      cur = 1 - cur;
+      bc  = b2;
+      t   = double(n->key);
+    }
+    if (bc != b) return 0;
+
+    // sum_j <j| exp(-(beta - t) H) V |j>
+    double const *e = ws.exp(eigenvalues.data() + block_offsets[b], beta - t, k);
+    h_scalar_t tr   = 0;
+    for (int j = 0; j < k; ++j) tr += V(j, j) * e[j];
+    return tr;
+  }
+
+  // -------- Single precision estimates ----------------
+
+  // As compute_matrix, in single precision and without caching : a copy of the cached matrix for an unmodified node
+  // (computed and cached in double precision if necessary), the product in single precision for a modified one.
+  // The matrix is scaled by exp(lscale), the sum of dtau * Emin over the intervals of the product, returned as the third element:
+  // the evolution factors are exp(-dtau * (E - Emin)) <= 1, and the elements stay in the normal range of float at low temperature.
+  // The products never reach BLAS, which has no single precision in nda : small_gemm uses its kernels or a plain loop.
+  // Serial : uses the workspaces of thread 0.
+  std::tuple<int, nda::matrix_const_view<h_scalar_float_t>, double> impurity_trace::compute_matrix_float(node n, int b, int depth) {
+
+    if (b == -1) return {-1, {}, 0};
+    if (n == nullptr) return {b, {}, 0};
+
+    auto &thread_workspaces = workspaces[0];
+    if (int(thread_workspaces.size()) <= depth) thread_workspaces.resize(depth + 1);
+    auto &ws = thread_workspaces[depth];
+
+    if (!n->modified) {
+      auto r = compute_matrix(n, b, 0, depth);
+      if (r.first == -1) return {-1, {}, 0};
+      double lscale = n->cache.matrix_lnorms[b], scale = std::exp(lscale);
+      if (!std::isfinite(scale)) lscale = 0, scale = 1; // a zero matrix (lnorm = double_max), or a norm below the normal range
+      auto M = ws.float_matrix(0, r.second.shape()[0], r.second.shape()[1]);
+      for (int i = 0; i < M.shape()[0]; ++i)
+        for (int j = 0; j < M.shape()[1]; ++j) M(i, j) = h_scalar_float_t(r.second(i, j) * scale);
+      return {r.first, M, lscale};
+    }
+    int cur = 0; // the buffer of ws holding M
+
+    auto [b1, R, lscale_r] = compute_matrix_float(n->right, b, depth + 1);
+    if (b1 == -1) return {-1, {}, 0};
+
+    int b2 = (n->delete_flag ? b1 : get_op_block_map(n, b1));
+    if (b2 == -1) return {-1, {}, 0};
+
+    double const *er = (n->right ? get_evolution_factors(n->cache.exp_r, n->cache.dtau_r, b1) : ones.data());
+    double const *el = (n->left ? get_evolution_factors(n->cache.exp_l, n->cache.dtau_l, b2) : ones.data());
+    double ls_r = n->cache.dtau_r * get_block_emin(b1), ls_l = n->cache.dtau_l * get_block_emin(b2);
+    double sr = std::exp(ls_r), sl = std::exp(ls_l);
+    int d1 = get_block_dim(b1), d2 = get_block_dim(b2);
+    auto M = ws.float_matrix(cur, d2, d1);
+    if (!n->delete_flag) {
+      auto const &op = get_op_block_matrix(n, b1);
+      for (int i = 0; i < d2; ++i)
+        for (int j = 0; j < d1; ++j) M(i, j) = h_scalar_float_t((el[i] * sl) * op(i, j) * (er[j] * sr));
+    } else
+      for (int i = 0; i < d2; ++i)
+        for (int j = 0; j < d1; ++j) M(i, j) = h_scalar_float_t(i == j ? (el[i] * sl) * (er[i] * sr) : 0);
+    double lscale = lscale_r + ls_r + ls_l;
+
+    if (n->right) { // M <- M * r[b]
+      auto P = ws.float_matrix(1 - cur, M.shape()[0], R.shape()[1]);
+      small_gemm(M, R, P);
+      M.rebind(P);
+      cur = 1 - cur;
+    }
+
+    int b3 = b2;
+    if (n->left) { // M <- l[b] * M
+      auto [bl, L, lscale_l] = compute_matrix_float(n->left, b2, depth + 1);
+      b3                     = bl;
+      if (b3 == -1) return {-1, {}, 0};
+      auto P = ws.float_matrix(1 - cur, L.shape()[0], M.shape()[1]);
+      small_gemm(L, M, P);
+      M.rebind(P);
+      cur = 1 - cur;
+      lscale += lscale_l;
+    }
+    return {b3, M, lscale};
+  }
+
+  // Yee criterion with |Tr_B| <= |Tr_B in single precision| + margin * bound of B, for the blocks in the order of the bounds.
+  // The margin bounds the rounding errors of the products : (number of operators + 1) x (largest dimension) x epsilon.
+  // It only holds in the normal range of float : the products are scaled by exp(sum of dtau * Emin), see compute_matrix_float,
+  // and with E_0 = 0 the scale of a subtree is at most the one of the block, which must not overflow in double precision.
+  // Returns true if the move can be rejected, false as soon as it is clear it can not.
+  bool impurity_trace::float_yee_reject(node root, double dtau, double p_yee, double u_yee) {
+    double margin = (tree_size + 1) * double(ones.size()) * std::numeric_limits<float>::epsilon();
+    if (margin >= 1) return false; // no better than the bounds
+    constexpr double max_lscale = 600; // exp(max_lscale) and its products with the elements are finite in double precision
+
+    double trace_max = 0; // bound of |trace| from the blocks done
+    for (int bl = 0; bl < int(to_sort_lnorm_b.size()); ++bl) {
+      if (std::abs(p_yee) * (trace_max + bound_cumul[bl]) < u_yee) return true;
+      if (to_sort_lnorm_b[bl].first > max_lscale) return false;
+
+      int block_index          = to_sort_lnorm_b[bl].second;
+      auto [b_end, M, lscale]  = compute_matrix_float(root, block_index);
+      double const *e          = get_evolution_factors(exp_dtau, dtau, block_index);
+      double ls                = dtau * get_block_emin(block_index);
+      double s                 = std::exp(ls);
+      h_scalar_t tr_scaled     = 0;
+      for (int u = 0; u < get_block_dim(block_index); ++u) tr_scaled += h_scalar_t(M(u, u)) * (e[u] * s);
+      h_scalar_t tr = tr_scaled * std::exp(-(lscale + ls));
+      if (!std::isfinite(std::abs(tr))) return false;
+
+      trace_max += std::abs(tr) + margin * (bound_cumul[bl] - bound_cumul[bl + 1]);
+      if (std::abs(p_yee) * trace_max >= u_yee) return false;
+    }
+    return true;
   }
 
   //-------- Compute the full trace ------------------------------------------
   // Returns MC atomic weight and reweighting = trace/(atomic weight)
-  std::pair<h_scalar_t, h_scalar_t> impurity_trace::compute(double p_yee, double u_yee) {
+  // With use_trace_estimator, the weight is |Tr_B| for the first block B, in the order of the bounds, with a non zero trace.
+  // It is non zero when the trace is, and only costs the dominant block in most cases.
+  // If estimate is true, the evaluation stops there and the reweighting is the sign of Tr_B,
+  // else all blocks are evaluated and the reweighting is the full trace / |Tr_B|.
+  std::pair<h_scalar_t, h_scalar_t> impurity_trace::compute_trace(double p_yee, double u_yee, bool estimate) {
 
     double epsilon         = 1.e-15; // Machine precision
     auto log_epsilon0      = -std::log(1.e-15);
     double lnorm_threshold = double_max - 100;
-    std::vector<std::pair<double, int>> init_to_sort_lnorm_b, to_sort_lnorm_b; // pairs of lnorm and b to sort in order of bound
+    init_to_sort_lnorm_b.clear();
+    to_sort_lnorm_b.clear();
+    trial_dominant_block = -1;
+    trial_dominant_trace = 0;
 
     // simplifies later code
     if (tree_size == 0) {
       if (use_norm_as_weight) {
-        density_matrix = atomic_rho;
+        for (int bl = 0; bl < n_blocks; ++bl) { // copy in place, no reallocation
+          density_matrix[bl].is_valid = atomic_rho[bl].is_valid;
+          density_matrix[bl].mat()    = atomic_rho[bl].mat;
+        }
         return {atomic_norm, atomic_z / atomic_norm};
       } else
         return {atomic_z, 1};
     }
 
+    // Put density_matrix to "not recomputed", also for a structural 0
+    for (int bl = 0; bl < n_blocks; ++bl) density_matrix[bl].is_valid = false;
+
     auto root = tree.get_root();
     // beta - tmax + tmin ! the tree is in REVERSE order
     double dtau_beta = beta - tree.min_key();
@@ -285,16 +718,29 @@ namespace triqs_cthyb {
     //  tree.graphviz(std::ofstream("tree_start_compute_trace"));
     // #endif
 
-    update_dtau(root); // recompute the dtau for modified nodes
+    update_dtau(root);      // recompute the dtau for modified nodes
+    clear_trial_matrices(); // in case of several computations of the same trial
+    if (use_state_propagation) {
+      propagation_path.clear();
+      collect_propagation_path(root);
+    }
+
+    // the block tables and bounds of all blocks at once
+    block_batch.reset(n_blocks);
+    compute_block_tables_and_bounds(root, block_batch);
 
-    for (int b = 0; b < n_blocks; ++b) {
-      auto block_lnorm_pair = compute_block_table_and_bound(root, b, lnorm_threshold);
+    block_batch.for_each_alive([&](int b) {
+      int b_final = block_batch.blocks[b];
+      // |Tr_B| <= sqrt(dim) x (Frobenius norm) <= sqrt(dim) x (product of the spectral bounds) x min(excess, sqrt(dim))
+      // with the excess the smallest ratio Frobenius norm / spectral bound of the cached matrices in the product.
+      double lnorm_b = block_batch.lnorms[b] - std::min(block_batch.lexcess[b], 0.5 * std::log(get_block_dim(b)));
+      if (std::isinf(lnorm_b)) lnorm_b = double_max;
 
-      // Check that the final block is the same as the initial block or -1, indicating structural cancellation
+      // Check that the final block is the same as the initial block, indicating no structural cancellation
       // This guarantees that the density matrix is blockwise diagonal (otherwise the code will have thrown an error).
       if (measure_density_matrix) {
         static bool first_warning_issued = false;
-        if ((not first_warning_issued) and (block_lnorm_pair.first != b) && (block_lnorm_pair.first != -1)) {
+        if ((not first_warning_issued) and (b_final != b)) {
           first_warning_issued = true;
           mpi::communicator world;
           if (world.rank() == 0)
@@ -305,12 +751,14 @@ namespace triqs_cthyb {
         }
       }
 
-      if (block_lnorm_pair.first == b) { // final structural check B ---> returns to B.
-        double lnorm    = block_lnorm_pair.second + dtau * get_block_emin(b);
+      // final structural check B ---> returns to B, and B has states to propagate
+      if (b_final == b && (!use_state_propagation || n_propagated_states[b] > 0)) {
+        double lnorm    = lnorm_b + dtau * get_block_emin(b);
+        if (lnorm > lnorm_threshold) return;
         lnorm_threshold = std::min(lnorm_threshold, lnorm + log_epsilon0);
         init_to_sort_lnorm_b.emplace_back(lnorm, b);
       }
-    }
+    });
 
     // recut since lnorm_threshold evolved in the previous loop
     for (auto const &b_b : init_to_sort_lnorm_b)
@@ -323,18 +771,22 @@ namespace triqs_cthyb {
     // Now sort the blocks non structurally 0 according to the bound
     std::sort(to_sort_lnorm_b.begin(), to_sort_lnorm_b.end());
 
+    // The dominant block of the last accepted configuration first : it usually still dominates, and the stopping and Yee
+    // criteria are met sooner. Not with the estimator, which must only depend on the configuration.
+    if (!use_trace_estimator && dominant_block >= 0) {
+      auto it = std::find_if(to_sort_lnorm_b.begin(), to_sort_lnorm_b.end(), [&](auto const &x) { return x.second == dominant_block; });
+      if (it != to_sort_lnorm_b.end()) std::rotate(to_sort_lnorm_b.begin(), it, it + 1);
+    }
+
     // Prepare to loop over all blocks (in sorted order).
     // According to estimator, truncate as epsilon.
-    h_scalar_t full_trace = 0, first_term = 0;
+    h_scalar_t full_trace = 0, first_term = 0, estimator_trace = 0;
     double norm_trace_sq = 0, trace_abs = 0;
 
-    // Put density_matrix to "not recomputed"
-    for (int bl = 0; bl < n_blocks; ++bl) density_matrix[bl].is_valid = false;
-
-    auto trace_contrib_block = std::vector<std::pair<double, int>>{}; //FIXME complex -- can histos handle this?
+    trace_contrib_block.clear(); //FIXME complex -- can histos handle this?
 
-    int n_bl         = to_sort_lnorm_b.size();        // number of blocks
-    auto bound_cumul = std::vector<double>(n_bl + 1); // cumulative sum of the bounds
+    int n_bl = to_sort_lnorm_b.size(); // number of blocks
+    bound_cumul.resize(n_bl + 1);      // cumulative sum of the bounds
     // The contribution to the trace from block B is bounded: |Tr_B| <= dim(B) * sum_{B} e^{Emin(B)*dtau}
     // Here we calculate the cumulative bound from each contributing (structurally non-zero) block to
     // determine at which block we have exceeded the bound and hence can stop.
@@ -347,23 +799,22 @@ namespace triqs_cthyb {
       for (int bl = n_bl - 1; bl >= 0; --bl) bound_cumul[bl] = bound_cumul[bl + 1] + std::exp(-to_sort_lnorm_b[bl].first);
     }
 
-    int bl;
-    for (bl = 0; bl < n_bl; ++bl) { // sum over all blocks
-
-      // stopping criterion
-      if ((bl > 0) && (bound_cumul[bl] <= std::abs(full_trace) * epsilon)) break;
+    // Yee criterion on the single precision estimates
+    if (use_float_estimates && (p_yee >= 0.0) && float_yee_reject(root, dtau, p_yee, u_yee)) return {0, 1};
 
+    // Evaluation of the contribution of block number bl (in sorted order), on a given thread
+    // Only writes in the density matrix of the block, the cache slots of the block, and the workspace of the thread.
+    auto evaluate_block = [&](int bl, int thread) {
       int block_index = to_sort_lnorm_b[bl].second; // index in original (unsorted) order
 
-      // additionnal Yee quick return criterion
-      if (p_yee >= 0.0) {
-        auto current_weight = (use_norm_as_weight ? std::sqrt(norm_trace_sq) : full_trace);
-        auto pmax           = std::abs(p_yee) * (std::abs(current_weight) + bound_cumul[bl]);
-        if (pmax < u_yee) return {0, 1}; // pmax < u, we can reject
+      if (use_state_propagation) {
+        auto x                                   = propagate_states(block_index, thread);
+        block_results[bl % block_results.size()] = {x, std::abs(x), 0};
+        return;
       }
 
       // computes the matrices, recursively along the modified path in the tree
-      auto b_mat = compute_matrix(root, block_index); // b_mat = {block that b connects to, matrix for this block}
+      auto b_mat = compute_matrix(root, block_index, thread); // b_mat = {block that b connects to, matrix for this block}
       if (b_mat.first == -1) TRIQS_RUNTIME_ERROR << " Internal error : B = -1 after compute matrix : " << block_index;
 
 #ifdef CHECK_AGAINST_LINEAR_COMPUTATION
@@ -372,53 +823,131 @@ namespace triqs_cthyb {
 #endif
 
       // trace(mat * exp(- H * (beta - tmax)) * exp (- H * tmin)) to handle the piece outside of the first-last operators.
-      h_scalar_t trace_partial = 0;
-      auto dim                 = get_block_dim(block_index);
+      // The exponentials are cached by block, and only recomputed when dtau changes.
+      block_result_t res{0, 0, 0};
+      auto dim        = get_block_dim(block_index);
+      double const *e = nullptr, *eb = nullptr, *e0 = nullptr;
+      if (use_norm_as_weight) { // exp(-dtau E) = exp(-dtau_beta E) * exp(-dtau_0 E), consistent with the density matrix below
+        eb = get_evolution_factors(exp_dtau_beta, dtau_beta, block_index);
+        e0 = get_evolution_factors(exp_dtau_0, dtau_0, block_index);
+      } else
+        e = get_evolution_factors(exp_dtau, dtau, block_index);
       for (int u = 0; u < dim; ++u) {
-        auto x = b_mat.second(u, u) * std::exp(-dtau * get_block_eigenval(block_index, u));
-        trace_partial += x;
-        trace_abs += std::abs(x);
+        auto x = b_mat.second(u, u) * (use_norm_as_weight ? eb[u] * e0[u] : e[u]);
+        res.trace_partial += x;
+        res.trace_abs += std::abs(x);
       }
 
       if (use_norm_as_weight) { // else we are not allowed to compute this matrix, may make no sense
         // recompute the density matrix
-        density_matrix[block_index].is_valid = true;
-        double norm_trace_sq_partial         = 0;
-        auto &mat                            = density_matrix[block_index].mat;
+        auto &mat = density_matrix[block_index].mat;
         for (int u = 0; u < dim; ++u) {
           for (int v = 0; v < dim; ++v) {
-            mat(u, v) = b_mat.second(u, v) * std::exp(-dtau_beta * get_block_eigenval(block_index, u) - dtau_0 * get_block_eigenval(block_index, v));
+            mat(u, v) = b_mat.second(u, v) * eb[u] * e0[v];
             double xx = std::abs(mat(u, v));
-            norm_trace_sq_partial += xx * xx;
+            res.norm_trace_sq += xx * xx;
           }
         }
-        norm_trace_sq += norm_trace_sq_partial;
         // internal check
-        if (std::abs(trace_partial) - 1.0000001 * std::sqrt(norm_trace_sq_partial) * get_block_dim(block_index) > 1.e-15)
-          TRIQS_RUNTIME_ERROR << "|trace| > dim * norm" << trace_partial << " " << std::sqrt(norm_trace_sq_partial) << "  " << trace_abs;
-        auto dev = std::abs(trace_partial - trace(mat));
+        if (std::abs(res.trace_partial) - 1.0000001 * std::sqrt(res.norm_trace_sq) * get_block_dim(block_index) > 1.e-15)
+          TRIQS_RUNTIME_ERROR << "|trace| > dim * norm" << res.trace_partial << " " << std::sqrt(res.norm_trace_sq) << "  " << res.trace_abs;
+        auto dev = std::abs(res.trace_partial - trace(mat));
         if (dev > 1.e-14) TRIQS_RUNTIME_ERROR << "Internal error : trace and density mismatch. Deviation: " << dev;
       }
 
 #ifdef CHECK_MATRIX_BOUNDED_BY_BOUND
-      if (std::abs(trace_partial) > 1.000001 * dim * std::exp(-to_sort_lnorm_b[bl].first))
-        TRIQS_RUNTIME_ERROR << "Matrix not bounded by the bound ! test is " << std::abs(trace_partial) << " < "
+      if (std::abs(res.trace_partial) > 1.000001 * dim * std::exp(-to_sort_lnorm_b[bl].first))
+        TRIQS_RUNTIME_ERROR << "Matrix not bounded by the bound ! test is " << std::abs(res.trace_partial) << " < "
                             << dim * std::exp(-to_sort_lnorm_b[bl].first);
 #endif
+      block_results[bl % block_results.size()] = res;
+    };
+
+    // With several threads, the blocks are evaluated by rounds of (up to) n_threads consecutive blocks.
+    // The results are then added in order, with the stopping and Yee criteria checked before each block exactly as
+    // in the serial evaluation : the weight is the same, only some blocks may have been evaluated in vain.
+    // The estimate usually stops at the first block : no rounds.
+    int n_per_round = (pool && blocks_connections_injective && !estimate ? pool->size() : 1);
+
+    // stopping criterion, before block bl
+    auto can_stop = [&](int bl) { return (bl > 0) && (bound_cumul[bl] <= std::abs(full_trace) * epsilon); };
+
+    // additionnal Yee quick return criterion, before block bl
+    auto yee_reject = [&](int bl) {
+      if (p_yee < 0.0) return false;
+      auto current_weight = (use_norm_as_weight ? std::sqrt(norm_trace_sq) : full_trace);
+      auto pmax           = std::abs(p_yee) * (std::abs(current_weight) + bound_cumul[bl]);
+      return pmax < u_yee; // pmax < u, we can reject
+    };
+
+    int bl    = 0;
+    bool stop = false;
+    while ((bl < n_bl) && !stop) { // sum over all blocks
+
+      if (can_stop(bl)) break;
+      if (yee_reject(bl)) return {0, 1};
+
+      int n_round = std::min(n_per_round, n_bl - bl);
+      if (n_round == 1)
+        evaluate_block(bl, 0);
+      else {
+        // serial pass : the lazily computed evolution factors are shared between the threads
+        for (int i = bl; i < bl + n_round && !use_state_propagation; ++i) {
+          int block_index = to_sort_lnorm_b[i].second;
+          prepare_evolution_factors(root, block_index);
+          if (use_norm_as_weight) {
+            get_evolution_factors(exp_dtau_beta, dtau_beta, block_index);
+            get_evolution_factors(exp_dtau_0, dtau_0, block_index);
+          } else
+            get_evolution_factors(exp_dtau, dtau, block_index);
+        }
+        pool->run(n_round, [&](int i, int thread) { evaluate_block(bl + i, thread); });
+      }
+
+      for (int i = 0; i < n_round; ++i, ++bl) {
+
+        if (i > 0) { // the criteria for the first block of the round have been checked above
+          if (can_stop(bl)) {
+            stop = true;
+            break;
+          }
+          if (yee_reject(bl)) return {0, 1};
+        }
 
-      full_trace += trace_partial; // sum for all blocks
-
-      // Analysis
-      if (histo) {
-        histo->trace_over_bound << std::abs(trace_partial) / std::exp(-to_sort_lnorm_b[bl].first);
-        trace_contrib_block.emplace_back(std::abs(trace_partial), block_index);
-        if (bl == 1) {
-          first_term = trace_partial;
-          histo->dominant_block_bound << block_index;
-          histo->dominant_block_energy_bound << get_block_emin(block_index);
-        } else if (first_term != 0.0) {
-          histo->trace_first_over_sec_term << real(trace_partial / first_term);
-	}
+        int block_index    = to_sort_lnorm_b[bl].second;
+        auto const &res    = block_results[bl % block_results.size()];
+        auto trace_partial = res.trace_partial;
+        trace_abs += res.trace_abs;
+        if (use_norm_as_weight) {
+          density_matrix[block_index].is_valid = true;
+          norm_trace_sq += res.norm_trace_sq;
+        }
+
+        full_trace += trace_partial; // sum for all blocks
+        if (std::abs(trace_partial) > trial_dominant_trace) {
+          trial_dominant_trace = std::abs(trace_partial);
+          trial_dominant_block = block_index;
+        }
+        if (estimator_trace == 0.0) estimator_trace = trace_partial;
+
+        // Analysis
+        if (histo) {
+          histo->trace_over_bound << std::abs(trace_partial) / std::exp(-to_sort_lnorm_b[bl].first);
+          trace_contrib_block.emplace_back(std::abs(trace_partial), block_index);
+          if (bl == 1) {
+            first_term = trace_partial;
+            histo->dominant_block_bound << block_index;
+            histo->dominant_block_energy_bound << get_block_emin(block_index);
+          } else if (first_term != 0.0) {
+            histo->trace_first_over_sec_term << real(trace_partial / first_term);
+          }
+        }
+
+        if (estimate && estimator_trace != 0.0) {
+          ++bl;
+          stop = true;
+          break;
+        }
       }
     } // loop on block
 
@@ -438,6 +967,10 @@ namespace triqs_cthyb {
     }
 
     // return {weight, reweighting}
+    if (use_trace_estimator) {
+      if (estimator_trace == 0.0) return {0, 1};
+      return {std::abs(estimator_trace), full_trace / std::abs(estimator_trace)};
+    }
     if (!use_norm_as_weight) return {full_trace, 1};
     // else determine reweighting
     auto rw = full_trace / norm_trace;
@@ -21,9 +21,17 @@
 #pragma once
 #include "./configuration.hpp"
 #include "./parameters.hpp"
+#include "./thread_pool.hpp"
+#include "./small_gemm.hpp"
+#include "./sparse_matrix.hpp"
+#include "./vexp.hpp"
 #include "triqs/utility/rbt.hpp"
 #include <triqs/stat/histograms.hpp>
 #include <triqs/atom_diag/atom_diag.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <span>
 
 //#define PRINT_CONF_DEBUG
 
@@ -43,17 +51,26 @@ namespace triqs_cthyb {
     double beta;
     bool use_norm_as_weight;
     bool measure_density_matrix;
+    bool use_trace_estimator;
+    bool use_state_propagation;
+    bool use_float_estimates;
 
     public:
     // construct from the config, the diagonalization of h_loc, and parameters
     impurity_trace(double beta, atom_diag const &h_diag, histo_map_t *hist_map,
-		   bool use_norm_as_weight=false, bool measure_density_matrix=false, bool performance_analysis=false);
+		   bool use_norm_as_weight=false, bool measure_density_matrix=false, bool performance_analysis=false, int n_threads=1,
+		   bool use_trace_estimator=false, bool use_state_propagation=false, double state_propagation_cutoff=1.e-12,
+		   bool use_float_estimates=false);
 
     ~impurity_trace() {
       cancel_insert_impl(); // in case of an exception, we need to remove any trial nodes before cleaning the tree!
     }
 
-    std::pair<h_scalar_t, h_scalar_t> compute(double p_yee = -1, double u_yee = 0);
+    // {weight, reweighting} for the Monte Carlo. With use_trace_estimator, weight * reweighting is only the sign of the trace.
+    std::pair<h_scalar_t, h_scalar_t> compute(double p_yee = -1, double u_yee = 0) { return compute_trace(p_yee, u_yee, use_trace_estimator); }
+
+    // {weight, reweighting} with weight * reweighting = the full trace, in all modes
+    std::pair<h_scalar_t, h_scalar_t> compute_full() { return compute_trace(-1, 0, false); }
 
     // ------- Configuration and h_loc data ----------------
 
@@ -71,31 +88,130 @@ namespace triqs_cthyb {
       matrix<h_scalar_t> mat;
     };
     std::vector<bool_and_matrix> density_matrix;    // density_matrix, by block, with a bool to say if it has been recomputed
+    std::vector<bool_and_matrix> accepted_density_matrix; // the same for the accepted configuration, swapped on confirmation
     std::vector<bool_and_matrix> atomic_rho;        // atomic density matrix (non-normalized)
     double atomic_z;                                // atomic partition function
     double atomic_norm;                             // Frobenius norm of atomic_rho
 
     public:
-    std::vector<bool_and_matrix> const &get_density_matrix() const { return density_matrix; }
+    // The density matrix of the accepted configuration : the trials leave it untouched
+    std::vector<bool_and_matrix> const &get_density_matrix() const { return accepted_density_matrix; }
 
     // ------------------ Cache data ----------------
 
     private:
+    // exp(-dtau * E_i) for all eigenstates i, computed block by block on demand, for the last value of dtau
+    struct evolution_factors_t {
+      double dtau = -1;
+      std::vector<double> values; // by eigenstate, block b starts at block_offsets[b]
+      std::vector<char> valid;    // by block
+    };
+
     // The data stored for each node in tree
+    // Structure of arrays : the per-block data are packed in one arena, the matrices of all blocks in one buffer
     struct cache_t {
-      double dtau_l = 0, dtau_r = 0;                    // difference in tau of this node and left and right sub-trees
-      std::vector<int> block_table;                     // number of blocks limited to 2^15
-      std::vector<arrays::matrix<h_scalar_t>> matrices; // partial product of operator/time evolution matrices
-      std::vector<double> matrix_lnorms;                // -ln(norm(matrix))
-      std::vector<bool> matrix_norm_valid;              // is the norm of the matrix still valid?
-      cache_t(int n_blocks) : block_table(n_blocks), matrices(n_blocks), matrix_lnorms(n_blocks), matrix_norm_valid(n_blocks) {}
+      double dtau_l = 0, dtau_r = 0;         // difference in tau of this node and left and right sub-trees
+      time_pt first_key, last_key;           // keys of the first and last nodes of the sub-tree, in tree order
+      std::span<double> matrix_lnorms;       // -ln(bound of the spectral norm of the matrix)
+      std::span<double> matrix_lexcess;      // ln(Frobenius norm / spectral bound) of the matrix, infinity if not known
+      std::span<long> matrix_offset;         // position of the matrix of each block in matrix_buffer (n_blocks + 1 entries)
+      std::span<int> block_table;            // number of blocks limited to 2^15
+      std::span<char> matrix_norm_valid;     // is the norm of the matrix still valid? One byte per block.
+      std::vector<h_scalar_t> matrix_buffer; // partial product of operator/time evolution matrices, for all blocks
+      evolution_factors_t exp_l, exp_r;      // exp(-dtau_l * E), exp(-dtau_r * E)
+
+      cache_t(int n_blocks) : arena(arena_size(n_blocks)) { bind(n_blocks); }
+      cache_t(cache_t const &c)
+         : dtau_l(c.dtau_l),
+           dtau_r(c.dtau_r),
+           first_key(c.first_key),
+           last_key(c.last_key),
+           matrix_buffer(c.matrix_buffer),
+           exp_l(c.exp_l),
+           exp_r(c.exp_r),
+           arena(c.arena) {
+        bind(c.block_table.size());
+      }
+      cache_t(cache_t &&c) noexcept
+         : dtau_l(c.dtau_l),
+           dtau_r(c.dtau_r),
+           first_key(c.first_key),
+           last_key(c.last_key),
+           matrix_buffer(std::move(c.matrix_buffer)),
+           exp_l(std::move(c.exp_l)),
+           exp_r(std::move(c.exp_r)),
+           arena(std::move(c.arena)) {
+        bind(c.block_table.size());
+        c.bind(0);
+      }
+      cache_t &operator=(cache_t const &c) {
+        dtau_l        = c.dtau_l;
+        dtau_r        = c.dtau_r;
+        first_key     = c.first_key;
+        last_key      = c.last_key;
+        matrix_buffer = c.matrix_buffer; // reuses the storage if large enough
+        exp_l         = c.exp_l;
+        exp_r         = c.exp_r;
+        arena         = c.arena;
+        bind(c.block_table.size());
+        return *this;
+      }
+      cache_t &operator=(cache_t &&c) noexcept {
+        if (this == &c) return *this;
+        dtau_l        = c.dtau_l;
+        dtau_r        = c.dtau_r;
+        first_key     = c.first_key;
+        last_key      = c.last_key;
+        matrix_buffer = std::move(c.matrix_buffer);
+        exp_l         = std::move(c.exp_l);
+        exp_r         = std::move(c.exp_r);
+        arena         = std::move(c.arena);
+        bind(c.block_table.size());
+        c.bind(0);
+        return *this;
+      }
+
+      private:
+      std::vector<std::byte> arena; // [matrix_lnorms | matrix_lexcess | matrix_offset | block_table | matrix_norm_valid]
+
+      static long arena_size(long n) { return 2 * n * sizeof(double) + (n + 1) * sizeof(long) + n * sizeof(int) + n * sizeof(char); }
+
+      // point the spans to their part of the arena
+      void bind(long n) {
+        if (n == 0) {
+          matrix_lnorms = {}, matrix_lexcess = {}, matrix_offset = {}, block_table = {}, matrix_norm_valid = {};
+          return;
+        }
+        std::byte *p      = arena.data();
+        matrix_lnorms     = {reinterpret_cast<double *>(p), size_t(n)};
+        matrix_lexcess    = {reinterpret_cast<double *>(p + n * sizeof(double)), size_t(n)};
+        matrix_offset     = {reinterpret_cast<long *>(p + 2 * n * sizeof(double)), size_t(n + 1)};
+        block_table       = {reinterpret_cast<int *>(p + 2 * n * sizeof(double) + (n + 1) * sizeof(long)), size_t(n)};
+        matrix_norm_valid = {reinterpret_cast<char *>(p + 2 * n * sizeof(double) + (n + 1) * sizeof(long) + n * sizeof(int)), size_t(n)};
+      }
     };
 
     struct node_data_t {
       op_desc op;
       cache_t cache;
+      std::vector<int> op_counts; // number of operators in the subtree by (block_index, dagger), at [2 * block_index + dagger]
       node_data_t(op_desc op, int n_blocks) : op(op), cache(n_blocks) {}
       void reset(op_desc op_new) { op = op_new; }
+      void reset(op_desc op_new, int) { op = op_new; } // recycled node: keep the cache storage
+
+      // called by the tree when the subtree changes
+      void update_subtree(node_data_t const *l, node_data_t const *r) {
+        int k = 2 * op.block_index + op.dagger;
+        op_counts.assign(std::max({l ? l->op_counts.size() : 0, r ? r->op_counts.size() : 0, size_t(k + 1)}), 0);
+        for (auto c : {l, r})
+          if (c)
+            for (int i = 0; i < int(c->op_counts.size()); ++i) op_counts[i] += c->op_counts[i];
+        op_counts[k]++;
+      }
+      int count(int block_index, bool dagger) const {
+        int k = 2 * block_index + dagger;
+        return (k < int(op_counts.size()) ? op_counts[k] : 0);
+      }
     };
 
     using rb_tree_t = rb_tree<time_pt, node_data_t, std::greater<time_pt>>;
@@ -111,26 +227,66 @@ namespace triqs_cthyb {
     // ---------------- Cache machinery ----------------
     void update_cache();
 
+    // Every compaction_period confirmed moves, relocate the nodes of the tree contiguously in time order
+    static constexpr int compaction_period = 10000;
+    int n_confirmed                        = 0;
+    void compact_tree() {
+      if (++n_confirmed % compaction_period == 0) tree.compact();
+    }
+
     private:
     // The dimension of block b
     int get_block_dim(int b) const { return h_diag->get_subspace_dim(b); }
 
+    // The cached matrix of block b on node n, in the matrix buffer of the node
+    nda::matrix_view<h_scalar_t> get_cached_matrix(node n, int b) const {
+      auto &c = n->cache;
+      return nda::matrix_view<h_scalar_t>{std::array<long, 2>{get_block_dim(c.block_table[b]), get_block_dim(b)},
+                                          c.matrix_buffer.data() + c.matrix_offset[b]};
+    }
+
     // the i-th eigenvalue of the block b
     double get_block_eigenval(int b, int i) const { return h_diag->get_eigenvalue(b, i); }
 
     // the minimal eigenvalue of the block b
     double get_block_emin(int b) const { return get_block_eigenval(b, 0); }
 
-    // node, block -> image of the block by n->op (the operator)
-    int get_op_block_map(node n, int b) const {
-      if( n->op.linear_index >= 0 )
-	return (n->op.dagger ? h_diag->cdag_connection(n->op.linear_index, b) : h_diag->c_connection(n->op.linear_index, b));
-      else {
-	int aux_idx = -n->op.linear_index - 1;
-	return aux_operators[aux_idx].connection(b);
+    // all eigenvalues, block after block, and the position of each block
+    std::vector<double> eigenvalues;
+    std::vector<int> block_offsets;
+    std::vector<double> ones; // 1 for the largest block, the "evolution factors" of a null dtau
+
+    // exp(-dtau * E_i) for the eigenstates i of block b. Cached in f, recomputed only if dtau has changed
+    double const *get_evolution_factors(evolution_factors_t &f, double dtau, int b) {
+      if (f.valid.empty() || dtau != f.dtau) {
+        f.dtau = dtau;
+        f.values.resize(n_eigstates);
+        f.valid.assign(n_blocks, 0);
+      }
+      double *p = f.values.data() + block_offsets[b];
+      if (!f.valid[b]) {
+        exp_neg_scaled(eigenvalues.data() + block_offsets[b], dtau, p, get_block_dim(b));
+        f.valid[b] = 1;
       }
+      return p;
     }
 
+    // The connections of the operators, flattened by (operator, block) as [op * n_blocks + b], -1 for no connection
+    std::vector<int> c_block_maps, cdag_block_maps, aux_block_maps;
+    void add_block_maps(std::vector<int> &v, auto const &get_connection) {
+      for (int b = 0; b < n_blocks; ++b) v.push_back(get_connection(b));
+    }
+
+    // block -> image of the block by n->op (the operator), as a table indexed by the block
+    int const *get_op_block_maps(node n) const {
+      long i = n->op.linear_index;
+      if (i < 0) return aux_block_maps.data() + (-i - 1) * n_blocks;
+      return (n->op.dagger ? cdag_block_maps : c_block_maps).data() + i * n_blocks;
+    }
+
+    // node, block -> image of the block by n->op (the operator)
+    int get_op_block_map(node n, int b) const { return get_op_block_maps(n)[b]; }
+
     // the matrix of n->op, from block b to its image
     matrix<h_scalar_t> const &get_op_block_matrix(node n, int b) const {
       if( n->op.linear_index >= 0 )
@@ -141,15 +297,161 @@ namespace triqs_cthyb {
       }
     }
 
+    // The block matrices of the operators in sparse form, by (operator, block), when they are sparse enough (see sparse_form)
+    std::vector<std::optional<csr_matrix<h_scalar_t>>> sparse_c, sparse_cdag, sparse_aux;
+    void add_sparse_forms(std::vector<std::optional<csr_matrix<h_scalar_t>>> &v, auto const &get_matrix, auto const &get_connection) {
+      for (int b = 0; b < n_blocks; ++b)
+        v.push_back(get_connection(b) == -1 ? std::nullopt : sparse_form(get_matrix(b)));
+    }
+
+    // the sparse form of the matrix of n->op from block b, null if it is not sparse
+    csr_matrix<h_scalar_t> const *get_op_block_sparse(node n, int b) const {
+      long i  = n->op.linear_index;
+      auto &v = (i < 0 ? sparse_aux : (n->op.dagger ? sparse_cdag : sparse_c));
+      auto &s = v[(i < 0 ? -i - 1 : i) * n_blocks + b];
+      return (s ? &*s : nullptr);
+    }
+
+    // The block tables of all the blocks, propagated together through the tree.
+    // For each initial block i : blocks[i], its image so far, lnorms[i], the bound so far,
+    // and lexcess[i], the smallest matrix_lexcess of the cached matrices in the product so far.
+    // alive : bit i is set while block i is not structurally cancelled, so that cancelled blocks cost nothing.
+    struct block_batch_t {
+      std::vector<int> blocks;
+      std::vector<double> lnorms, lexcess;
+      std::vector<uint64_t> alive;
+      int n_alive = 0;
+
+      void reset(int n) {
+        blocks.resize(n);
+        lnorms.assign(n, 0);
+        lexcess.assign(n, std::numeric_limits<double>::infinity());
+        alive.assign((n + 63) / 64, 0);
+        for (int i = 0; i < n; ++i) {
+          blocks[i] = i;
+          alive[i / 64] |= uint64_t(1) << (i % 64);
+        }
+        n_alive = n;
+      }
+      void kill(int i) {
+        alive[i / 64] &= ~(uint64_t(1) << (i % 64));
+        --n_alive;
+      }
+      // f(i) for all alive blocks i. f may kill i.
+      template <typename F> void for_each_alive(F &&f) {
+        for (int w = 0; w < int(alive.size()); ++w)
+          for (uint64_t x = alive[w]; x; x &= x - 1) f(64 * w + __builtin_ctzll(x));
+      }
+    };
+    block_batch_t block_batch;
+
     // recursive function for tree traversal
     int compute_block_table(node n, int b);
-    std::pair<int, double> compute_block_table_and_bound(node n, int b, double bound_threshold, bool use_threshold = true);
-    std::pair<int, matrix_t> compute_matrix(node n, int b);
-
-    void update_cache_impl(node n);
+    void compute_block_tables_and_bounds(node n, block_batch_t &bt);
+    std::pair<int, nda::matrix_const_view<h_scalar_t>> compute_matrix(node n, int b, int thread = 0, int depth = 0);
+    int prepare_evolution_factors(node n, int b);
+
+    int collect_modified_nodes(node n);
+    void update_cache_node(node n, int b_begin, int b_end);
+    void carve_matrix_buffer(node n);
+    std::vector<std::vector<node>> update_levels;           // the modified nodes, by level from the bottom of the tree
+    static constexpr long parallel_update_cutoff = 1 << 14; // minimal (number of nodes) x (number of blocks) for a parallel update
+    static constexpr int min_blocks_per_task     = 16;      // when the blocks of a node are split between threads
     void update_dtau(node n);
-
-    bool use_norm_of_matrices_in_cache = true; // When a matrix is computed in cache, its spectral radius replaces the norm estimate
+    void store_in_cache(node n, int b, nda::matrix_const_view<h_scalar_t> M);
+
+    bool use_norm_of_matrices_in_cache = true; // When a matrix is computed in cache, the bound of its norm replaces the estimate
+
+    // The block with the largest contribution to the trace, for the last accepted configuration and for the trial.
+    // It is evaluated first.
+    int dominant_block = -1, trial_dominant_block = -1;
+    double trial_dominant_trace = 0;
+
+    // The trace, or its estimate if estimate is true (see impurity_trace.cpp)
+    std::pair<h_scalar_t, h_scalar_t> compute_trace(double p_yee, double u_yee, bool estimate);
+
+    // ---------------- Trace by propagation of states ----------------
+    // With use_state_propagation, the trace of a block is restricted to its low-energy states,
+    // which are propagated through the operators : no block matrix is cached, nor multiplied by another one.
+    std::vector<int> n_propagated_states; // by block : number of states kept (the lowest ones)
+    std::vector<node> propagation_path;   // the operators of the current trial, in increasing time
+    void collect_propagation_path(node n);
+    h_scalar_t propagate_states(int b, int thread);
+
+    // ---------------- Single precision estimates ----------------
+    // With use_float_estimates, the Yee criterion is first checked on single precision estimates of the block traces,
+    // computed from single precision copies of the cached matrices : most moves are rejected before any double precision product.
+    std::tuple<int, nda::matrix_const_view<h_scalar_float_t>, double> compute_matrix_float(node n, int b, int depth = 0);
+    bool float_yee_reject(node root, double dtau, double p_yee, double u_yee);
+
+    // ---------------- Workspaces of compute ----------------
+    // Scratch storage kept from one call of compute to the next: no allocation in the long run
+
+    // Two buffers for the matrix products at one depth of the recursion in compute_matrix
+    struct workspace_t {
+      std::vector<h_scalar_t> buffers[2];
+      std::vector<h_scalar_float_t> float_buffers[2];
+      std::vector<double> exp_factors;
+      // a n_rows x n_cols matrix in buffer i
+      nda::matrix_view<h_scalar_t> matrix(int i, long n_rows, long n_cols) {
+        auto &buf = buffers[i];
+        if (long(buf.size()) < n_rows * n_cols) buf.resize(n_rows * n_cols);
+        return nda::matrix_view<h_scalar_t>{std::array<long, 2>{n_rows, n_cols}, buf.data()};
+      }
+      // the same in single precision
+      nda::matrix_view<h_scalar_float_t> float_matrix(int i, long n_rows, long n_cols) {
+        auto &buf = float_buffers[i];
+        if (long(buf.size()) < n_rows * n_cols) buf.resize(n_rows * n_cols);
+        return nda::matrix_view<h_scalar_float_t>{std::array<long, 2>{n_rows, n_cols}, buf.data()};
+      }
+      // exp(-dtau E) for the eigenvalues e of a block
+      double const *exp(double const *e, double dtau, int dim) {
+        if (int(exp_factors.size()) < dim) exp_factors.resize(dim);
+        exp_neg_scaled(e, dtau, exp_factors.data(), dim);
+        return exp_factors.data();
+      }
+    };
+    // For each thread, one workspace per depth. A deque: growing it keeps the references to the workspaces valid
+    std::vector<std::deque<workspace_t>> workspaces;
+
+    std::vector<std::pair<double, int>> init_to_sort_lnorm_b, to_sort_lnorm_b; // pairs of lnorm and b to sort in order of bound
+    std::vector<double> bound_cumul;                                           // cumulative sum of the bounds
+    std::vector<std::pair<double, int>> trace_contrib_block;                   // for analysis only
+    evolution_factors_t exp_dtau, exp_dtau_beta, exp_dtau_0;                   // outside of the first-last operators
+
+    // ---------------- Parallel evaluation of the blocks ----------------
+    // Several blocks are evaluated at the same time by a pool of threads.
+    // Two blocks never write to the same cache slot, since the connections between blocks are one-to-one.
+    // This holds for the c, c^dagger but must be checked for the auxiliary operators.
+    struct block_result_t {
+      h_scalar_t trace_partial;
+      double trace_abs, norm_trace_sq;
+    };
+    std::unique_ptr<thread_pool> pool;          // null for a serial evaluation
+    std::vector<block_result_t> block_results;  // results of the blocks of the current round
+    bool blocks_connections_injective = true;   // false if an auxiliary operator maps two blocks to the same block
+
+    // ---------------- Matrices of the trial ----------------
+    // The products computed by compute_matrix on the modified nodes during a trial are kept, with the interval of keys
+    // of their sub-tree. Such a product only depends on the operators in this interval : on confirmation, it is the matrix
+    // of the node with the same interval in the new tree, and is promoted to its cache instead of being recomputed.
+    struct trial_matrix_t {
+      time_pt first_key, last_key; // interval of the sub-tree
+      int b, b_out;                // block and its image
+      int thread;                  // the thread whose buffer holds the matrix
+      long offset;                 // position of the matrix in this buffer
+    };
+    struct trial_matrices_t {
+      std::vector<trial_matrix_t> matrices;
+      std::vector<h_scalar_t> buffer;
+    };
+    std::vector<trial_matrices_t> trial_matrices;     // by thread
+    std::vector<trial_matrix_t> trial_matrices_sorted; // all threads, sorted by interval and block, for the promotion
+    void keep_trial_matrix(node n, int b, int b_out, nda::matrix_const_view<h_scalar_t> M, int thread);
+    void promote_trial_matrices();
+    void clear_trial_matrices() {
+      for (auto &t : trial_matrices) t.matrices.clear(), t.buffer.clear();
+    }
 
     // integrity check
     void check_cache_integrity(bool print = false);
@@ -157,22 +459,23 @@ namespace triqs_cthyb {
     int check_one_block_table_linear(node n, int b, bool print);       // compare block table to that of a linear method (ie. no tree)
     matrix_t check_one_block_matrix_linear(node n, int b);             // compare matrix to that of a linear method (ie. no tree)
 
-    // Pool of detached nodes
+    // Pool of detached nodes, taken from (and given back to) the node pool of the tree
     class nodes_storage {
 
+      rb_tree_t &tree;
       const int n_blocks;
       std::vector<node> nodes;
       int i;
 
-      // make a new detached black node
-      node make_new_node() { return new rb_tree_t::node_t(time_pt{}, node_data_t{{}, n_blocks}, false, 1); }
+      // make a new detached node
+      node make_new_node() { return tree.make_node(time_pt{}, op_desc{}, n_blocks); }
 
       public:
-      inline nodes_storage(int n_blocks, int size = 0) : n_blocks(n_blocks), i(-1) {
+      inline nodes_storage(rb_tree_t &tree, int n_blocks, int size = 0) : tree(tree), n_blocks(n_blocks), i(-1) {
         for (int j = 0; j < size; ++j) nodes.push_back(make_new_node());
       }
       inline ~nodes_storage() {
-        for (auto &n : nodes) delete n;
+        for (auto &n : nodes) tree.release_node(n);
       }
 
       // Change the number of stored nodes
@@ -204,6 +507,16 @@ namespace triqs_cthyb {
     // attach auxiliary operators
     op_desc attach_aux_operator(many_body_op_t const &op) {
       aux_operators.push_back(h_diag->get_op_mat(op));
+      auto const &aux = aux_operators.back();
+      add_sparse_forms(sparse_aux, [&aux](int b) -> auto const & { return aux.block_mat[b]; }, [&aux](int b) { return aux.connection(b); });
+      add_block_maps(aux_block_maps, [&aux](int b) { return aux.connection(b); });
+      std::vector<bool> is_target(n_blocks, false);
+      for (int b = 0; b < n_blocks; ++b) {
+        int bp = aux_operators.back().connection(b);
+        if (bp == -1) continue;
+        if (is_target[bp]) blocks_connections_injective = false; // the blocks will be evaluated serially
+        is_target[bp] = true;
+      }
       op_desc operator_desc{0, 0, true, -static_cast<int>(aux_operators.size())};
       return operator_desc;
     }
@@ -217,7 +530,7 @@ namespace triqs_cthyb {
     int tree_size = 0; // size of the tree +/- the added/deleted node
 
     // a pool of trial nodes, ready to be glued in the tree. Max 4 to allow for double insertions
-    nodes_storage trial_nodes = {n_blocks, 4};
+    nodes_storage trial_nodes = {tree, n_blocks, 4};
 
     // for each inserted node, need to know {parent_of_node,child_is_left}
     std::vector<std::pair<node, bool>> inserted_nodes = {{nullptr, false}, {nullptr, false}, {nullptr, false}, {nullptr, false}};
@@ -263,7 +576,9 @@ namespace triqs_cthyb {
     // Remove all trial nodes from the tree
     void cancel_insert() {
       cancel_insert_impl();
+      update_dtau(tree.get_root()); // restore the dtau of the nodes modified by the trial, used by compute_matrix
       trial_nodes.reset_index();
+      clear_trial_matrices();
       tree_size = tree.size();
       tree.clear_modified();
       check_cache_integrity();
@@ -276,12 +591,13 @@ namespace triqs_cthyb {
       int imax = trial_nodes.reset_index();
       for (int i = 0; i <= imax; ++i) {
         node n = trial_nodes.take_next();
-        tree.insert(n->key, {n->op, n_blocks});
+        tree.emplace(n->key, n->op, n_blocks); // recycles a deleted node and its cache if possible
       }
       trial_nodes.reset_index();
       update_cache();
       tree_size = tree.size();
       tree.clear_modified();
+      compact_tree();
       check_cache_integrity();
     }
 
@@ -293,15 +609,33 @@ namespace triqs_cthyb {
     std::vector<time_pt> removed_keys;
 
     public:
+    // The numbers of operators by (block_index, dagger), at [2 * block_index + dagger] : above, at times larger than tau, and in total.
+    // O(log n)
+    void count_operators(time_pt const &tau, std::vector<int> &above, std::vector<int> &total) const {
+      auto root = tree.get_root();
+      total     = (root ? root->op_counts : std::vector<int>{});
+      above.assign(total.size(), 0);
+      tree.visit_less_than(tau, [&](node x, bool subtree) { // NB : the tree is in decreasing time
+        if (subtree)
+          for (int k = 0; k < int(x->op_counts.size()); ++k) above[k] += x->op_counts[k];
+        else
+          above[2 * x->op.block_index + x->op.dagger]++;
+      });
+    }
+
+    // The nth operator of the configuration, in decreasing time. O(log n)
+    std::pair<time_pt, op_desc> get_operator(int n) const {
+      node x = tree.select_if(n, [](node no) { return no->N; }, [](node) { return true; });
+      return {x->key, x->op};
+    }
+
     // Find and mark as deleted the nth operator with fixed dagger and block_index
     // n=0 : first operator, n=1, second, etc...
     time_pt try_delete(int n, int block_index, bool dagger) noexcept {
-      // traverse the tree, looking for the nth operator of the correct dagger, block_index
-      int i  = 0;
-      node x = find_if(tree, [&](node no) {
-        if (no->op.dagger == dagger && no->op.block_index == block_index) ++i;
-        return i == n + 1;
-      });
+      // descend the tree with the counts of the operators of the subtrees : O(log n)
+      node x = tree.select_if(
+         n, [&](node no) { return no->count(block_index, dagger); },
+         [&](node no) { return no->op.dagger == dagger && no->op.block_index == block_index; });
       removed_nodes.push_back(x);             // store the node
       removed_keys.push_back(x->key);         // store the key
       tree.set_modified_from_root_to(x->key); // mark all nodes on path from node to root as modified
@@ -315,6 +649,7 @@ namespace triqs_cthyb {
       for (auto &n : removed_nodes) n->delete_flag = false;
       removed_nodes.clear();
       removed_keys.clear();
+      clear_trial_matrices();
       tree_size = tree.size();
       tree.clear_modified();
       check_cache_integrity();
@@ -328,6 +663,7 @@ namespace triqs_cthyb {
       update_cache();
       tree_size = tree.size();
       tree.clear_modified();
+      compact_tree();
       check_cache_integrity();
     }
 
@@ -342,12 +678,14 @@ namespace triqs_cthyb {
 
       // Inserted nodes
       cancel_insert_impl();
+      update_dtau(tree.get_root()); // restore the dtau of the nodes modified by the trial, used by compute_matrix
       trial_nodes.reset_index();
 
       // Deleted nodes
       for (auto &n : removed_nodes) n->delete_flag = false;
       removed_nodes.clear();
       removed_keys.clear();
+      clear_trial_matrices();
 
       tree_size = tree.size();
       tree.clear_modified();
@@ -364,7 +702,7 @@ namespace triqs_cthyb {
       int imax = trial_nodes.reset_index();
       for (int i = 0; i <= imax; ++i) {
         node n = trial_nodes.take_next();
-        tree.insert(n->key, {n->op, n_blocks});
+        tree.emplace(n->key, n->op, n_blocks); // recycles a deleted node and its cache if possible
       }
       trial_nodes.reset_index();
 
@@ -377,6 +715,7 @@ namespace triqs_cthyb {
       update_cache();
       tree_size = tree.size();
       tree.clear_modified();
+      compact_tree();
       check_cache_integrity();
     }
 
@@ -385,7 +724,7 @@ namespace triqs_cthyb {
      *************************************************************************/
     private:
     // Store copies of the nodes to be replaced
-    nodes_storage backup_nodes = {n_blocks};
+    nodes_storage backup_nodes = {tree, n_blocks};
 
     node try_replace_impl(node n, configuration::oplist_t const &updated_ops) noexcept {
 
@@ -413,6 +752,7 @@ namespace triqs_cthyb {
         new_node->color    = color;
         new_node->N        = N;
         new_node->modified = true;
+        new_node->update_subtree(new_left, new_right);
       }
       return new_node;
     }
@@ -439,6 +779,7 @@ namespace triqs_cthyb {
       backup_nodes.reset_index();
       update_cache();
       tree.clear_modified();
+      compact_tree();
       check_cache_integrity();
     }
 
@@ -446,6 +787,7 @@ namespace triqs_cthyb {
       if (tree_size == 0 || backup_nodes.is_index_reset()) return;
       auto &root = tree.get_root();
       root       = cancel_replace_impl(root);
+      clear_trial_matrices();
       check_cache_integrity();
     }
 
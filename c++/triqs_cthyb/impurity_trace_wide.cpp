@@ -0,0 +1,743 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#include "impurity_trace_wide.hpp"
+#include <nda/nda.hpp>
+#include <nda/blas.hpp>
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+namespace triqs_cthyb {
+
+  namespace {
+    double wide_double_max = std::numeric_limits<double>::max();
+  } // namespace
+
+  // -------- Constructor --------
+  impurity_trace_wide::impurity_trace_wide(double beta, atom_diag const &h_diag_, histo_map_t *, bool use_norm_as_weight,
+                                           bool measure_density_matrix, bool performance_analysis, int n_threads, bool use_trace_estimator,
+                                           bool use_state_propagation, double, bool use_float_estimates)
+     : beta(beta),
+       use_norm_as_weight(use_norm_as_weight),
+       measure_density_matrix(measure_density_matrix),
+       use_trace_estimator(use_trace_estimator),
+       h_diag(&h_diag_),
+       density_matrix(n_blocks),
+       atomic_rho(n_blocks),
+       atomic_z(partition_function(*h_diag, beta)),
+       atomic_norm(0) {
+
+    if (performance_analysis) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: performance_analysis is only available with the red black tree trace";
+    if (use_state_propagation) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: use_state_propagation is only available with the red black tree trace";
+    if (use_float_estimates) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: use_float_estimates is only available with the red black tree trace";
+
+    // threads for the evaluation of the blocks
+    if (n_threads < 1) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: the number of threads must be >= 1, got " << n_threads;
+    if (n_threads > 1) pool = std::make_unique<thread_pool>(n_threads);
+    workspaces.resize(n_threads);
+    block_results.resize(n_threads);
+
+    // the estimate is a function of the configuration only : bounds independent of the cached matrices
+    if (use_trace_estimator) {
+      if (use_norm_as_weight) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: use_trace_estimator and use_norm_as_weight can not be used together";
+      use_norm_of_matrices_in_cache = false;
+    }
+
+    // eigenvalues, flattened
+    for (int bl = 0; bl < n_blocks; ++bl) {
+      block_offsets.push_back(eigenvalues.size());
+      for (int u = 0; u < get_block_dim(bl); ++u) eigenvalues.push_back(h_diag->get_eigenvalue(bl, u));
+    }
+
+    // the connections and the sparse forms of the operators
+    for (int op = 0; op < int(h_diag->get_fops().size()); ++op) {
+      add_block_maps(c_block_maps, [&](int b) { return h_diag->c_connection(op, b); });
+      add_block_maps(cdag_block_maps, [&](int b) { return h_diag->cdag_connection(op, b); });
+      add_sparse_forms(
+         sparse_c, [&](int b) -> auto const & { return h_diag->c_matrix(op, b); }, [&](int b) { return h_diag->c_connection(op, b); });
+      add_sparse_forms(
+         sparse_cdag, [&](int b) -> auto const & { return h_diag->cdag_matrix(op, b); }, [&](int b) { return h_diag->cdag_connection(op, b); });
+    }
+
+    // init density_matrix block + bool
+    for (int bl = 0; bl < n_blocks; ++bl) density_matrix[bl] = bool_and_matrix{false, matrix_t(get_block_dim(bl), get_block_dim(bl))};
+
+    // prepare atomic_rho and atomic_norm
+    if (use_norm_as_weight) {
+      auto rho = atomic_density_matrix(h_diag_, beta);
+      for (int bl = 0; bl < n_blocks; ++bl) {
+        atomic_rho[bl] = bool_and_matrix{true, rho[bl] * atomic_z};
+        for (int u = 0; u < get_block_dim(bl); ++u) {
+          auto xx = std::abs(rho[bl](u, u));
+          atomic_norm += xx * xx;
+        }
+      }
+      atomic_norm = std::sqrt(atomic_norm);
+    }
+
+    // the accepted configuration is empty
+    accepted_density_matrix = (use_norm_as_weight ? atomic_rho : density_matrix);
+  }
+
+  // -------- Auxiliary operators --------
+
+  op_desc impurity_trace_wide::attach_aux_operator(many_body_op_t const &op) {
+    aux_operators.push_back(h_diag->get_op_mat(op));
+    auto const &aux = aux_operators.back();
+    add_sparse_forms(sparse_aux, [&aux](int b) -> auto const & { return aux.block_mat[b]; }, [&aux](int b) { return aux.connection(b); });
+    add_block_maps(aux_block_maps, [&aux](int b) { return aux.connection(b); });
+    std::vector<bool> is_target(n_blocks, false);
+    for (int b = 0; b < n_blocks; ++b) {
+      int bp = aux_operators.back().connection(b);
+      if (bp == -1) continue;
+      if (is_target[bp]) blocks_connections_injective = false; // the blocks will be evaluated serially
+      is_target[bp] = true;
+    }
+    return op_desc{0, 0, true, -static_cast<int>(aux_operators.size())};
+  }
+
+  //====== Tree structure ======
+
+  int impurity_trace_wide::new_node(int level) {
+    int x;
+    if (free_nodes.empty()) {
+      x = nodes.size();
+      nodes.emplace_back();
+    } else {
+      x = free_nodes.back();
+      free_nodes.pop_back();
+    }
+    auto &n = nodes[x]; // a recycled node keeps the storage of its caches
+    n.parent = -1, n.level = level;
+    n.entries.clear(), n.children.clear();
+    n.modified = n.trial_tables_valid = false;
+    return x;
+  }
+
+  void impurity_trace_wide::free_node(int x) {
+    nodes[x].parent = -2; // not in the tree
+    free_nodes.push_back(x);
+  }
+
+  // The leaf where key is, or would be inserted
+  int impurity_trace_wide::find_leaf(time_pt const &key) const {
+    int x = root;
+    while (!nodes[x].is_leaf()) {
+      auto const &ch = nodes[x].children;
+      auto it        = std::find_if(ch.begin(), ch.end() - 1, [&](int c) { return !(nodes[c].last_key < key); });
+      x              = *it;
+    }
+    return x;
+  }
+
+  // The time span and the operator counts of x, from its entries or children
+  void impurity_trace_wide::update_span(int x) {
+    auto &n = nodes[x];
+    n.n_ops = 0;
+    n.op_counts.clear();
+    auto add = [&n](int k, int c) {
+      if (k >= int(n.op_counts.size())) n.op_counts.resize(k + 1, 0);
+      n.op_counts[k] += c;
+    };
+    if (n.is_leaf()) {
+      n.n_ops = n.entries.size();
+      for (auto const &e : n.entries) add(2 * e.op.block_index + e.op.dagger, 1);
+    } else
+      for (int c : n.children) {
+        n.n_ops += nodes[c].n_ops;
+        for (int k = 0; k < int(nodes[c].op_counts.size()); ++k) add(k, nodes[c].op_counts[k]);
+      }
+
+    if (n.is_leaf()) {
+      if (n.entries.empty()) return;
+      n.first_key = n.entries.front().key;
+      n.last_key  = n.entries.back().key;
+    } else {
+      n.first_key = nodes[n.children.front()].first_key;
+      n.last_key  = nodes[n.children.back()].last_key;
+    }
+  }
+
+  // Mark the leaf and its ancestors as modified for the current trial, and update their time span
+  void impurity_trace_wide::mark_modified(int leaf) {
+    for (int x = leaf; x != -1; x = nodes[x].parent) {
+      auto &n = nodes[x];
+      if (!n.modified) modified_nodes.push_back(x);
+      n.modified           = true;
+      n.trial_tables_valid = false;
+      update_span(x);
+    }
+  }
+
+  // Sort nodes from the leaves to the root, removing duplicates
+  void impurity_trace_wide::sort_by_level(std::vector<int> &v) const {
+    std::sort(v.begin(), v.end(), [this](int x, int y) { return std::make_pair(nodes[x].level, x) < std::make_pair(nodes[y].level, y); });
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+  }
+
+  // Split x in two halves. The second one is a new node, inserted after x in the parent (a new root if x is the root)
+  void impurity_trace_wide::split(int x) {
+    int y    = new_node(nodes[x].level);
+    auto &n  = nodes[x];
+    auto &ny = nodes[y];
+    int half = n.size() / 2;
+    if (n.is_leaf()) {
+      ny.entries.assign(n.entries.begin() + half, n.entries.end());
+      n.entries.resize(half);
+    } else {
+      ny.children.assign(n.children.begin() + half, n.children.end());
+      n.children.resize(half);
+      for (int c : ny.children) nodes[c].parent = y;
+    }
+    update_span(x), update_span(y);
+    dirty_nodes.push_back(x), dirty_nodes.push_back(y);
+
+    if (n.parent == -1) { // grow a new root
+      root                = new_node(n.level + 1);
+      nodes[root].children = {x, y};
+      dirty_nodes.push_back(root);
+      update_span(root);
+      n.parent = root;
+    } else {
+      auto &ch = nodes[n.parent].children;
+      ch.insert(std::find(ch.begin(), ch.end(), x) + 1, y);
+    }
+    ny.parent = n.parent;
+  }
+
+  // Merge x with its next (or previous) sibling. The merged node is split again if too large.
+  void impurity_trace_wide::merge_with_sibling(int x) {
+    auto &ch = nodes[nodes[x].parent].children;
+    int i    = std::find(ch.begin(), ch.end(), x) - ch.begin();
+    int l = (i + 1 < int(ch.size()) ? x : ch[i - 1]), r = (l == x ? ch[i + 1] : x); // l absorbs r
+    auto &nl = nodes[l];
+    auto &nr = nodes[r];
+    if (nl.is_leaf())
+      nl.entries.insert(nl.entries.end(), nr.entries.begin(), nr.entries.end());
+    else {
+      for (int c : nr.children) nodes[c].parent = l;
+      nl.children.insert(nl.children.end(), nr.children.begin(), nr.children.end());
+    }
+    ch.erase(std::find(ch.begin(), ch.end(), r));
+    free_node(r);
+    update_span(l);
+    dirty_nodes.push_back(l);
+    if (nl.size() > max_fanout) split(l);
+  }
+
+  // Restore the bounds of the size of x, and then of its ancestors
+  void impurity_trace_wide::rebalance(int x) {
+    while (x != -1 && nodes[x].parent != -2) {
+      auto &n = nodes[x];
+      int p   = n.parent;
+      if (p == -1) { // the root
+        if (n.size() == 0) {
+          free_node(x);
+          root = -1;
+        } else if (!n.is_leaf() && n.size() == 1) { // a root with one child : the tree is one level shallower
+          root               = n.children[0];
+          nodes[root].parent = -1;
+          free_node(x);
+          x = root;
+          continue;
+        } else if (n.size() > max_fanout) {
+          split(x);
+          x = nodes[x].parent;
+          continue;
+        }
+        return;
+      }
+      if (n.size() == 0) { // remove an empty node
+        auto &ch = nodes[p].children;
+        ch.erase(std::find(ch.begin(), ch.end(), x));
+        free_node(x);
+      } else if (n.size() > max_fanout)
+        split(x);
+      else if (n.size() < min_fanout && nodes[p].size() > 1)
+        merge_with_sibling(x);
+      else
+        return;
+      x = p;
+    }
+  }
+
+  //====== Trial moves ======
+
+  void impurity_trace_wide::try_insert(time_pt const &tau, op_desc const &op) {
+    if (root == -1) {
+      root = new_node(0);
+      nodes[root].entries.push_back({tau, op});
+      inserted_entries.emplace_back(root, tau);
+      mark_modified(root);
+      tree_size++;
+      return;
+    }
+    int x        = find_leaf(tau);
+    auto &e      = nodes[x].entries;
+    auto it      = std::lower_bound(e.begin(), e.end(), tau, [](entry_t const &a, time_pt const &t) { return a.key < t; });
+    if (it != e.end() && it->key == tau) throw triqs::utility::rbt_insert_error{};
+    e.insert(it, {tau, op});
+    inserted_entries.emplace_back(x, tau);
+    mark_modified(x);
+    tree_size++;
+  }
+
+  time_pt impurity_trace_wide::try_delete(int n, int block_index, bool dagger) {
+    // descend in decreasing time with the operator counts of the nodes, to the leaf of the nth operator of the correct dagger, block_index
+    if (root == -1 || nodes[root].count(block_index, dagger) <= n) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: no operator to delete";
+    int x = root;
+    while (!nodes[x].is_leaf())
+      for (auto it = nodes[x].children.rbegin();; ++it) {
+        int c = nodes[*it].count(block_index, dagger);
+        if (n < c) {
+          x = *it;
+          break;
+        }
+        n -= c;
+      }
+    auto found = nodes[x].entries.rbegin();
+    for (;; ++found)
+      if (found->op.dagger == dagger && found->op.block_index == block_index && (n-- == 0)) break;
+    found->deleted = true;
+    deleted_entries.emplace_back(x, found->key);
+    mark_modified(x);
+    tree_size--;
+    return found->key;
+  }
+
+  std::pair<time_pt, op_desc> impurity_trace_wide::get_operator(int n) const {
+    int x = root;
+    while (!nodes[x].is_leaf())
+      for (auto it = nodes[x].children.rbegin();; ++it) {
+        if (n < nodes[*it].n_ops) {
+          x = *it;
+          break;
+        }
+        n -= nodes[*it].n_ops;
+      }
+    auto const &e = nodes[x].entries[nodes[x].entries.size() - 1 - n];
+    return {e.key, e.op};
+  }
+
+  void impurity_trace_wide::count_operators(time_pt const &tau, std::vector<int> &above, std::vector<int> &total) const {
+    total = (root == -1 ? std::vector<int>{} : nodes[root].op_counts);
+    above.assign(total.size(), 0);
+    if (root == -1) return;
+    // the children after the one which contains tau are above it
+    int x = root;
+    while (!nodes[x].is_leaf()) {
+      auto const &ch = nodes[x].children;
+      int i          = ch.size() - 1;
+      for (; i > 0 && tau < nodes[ch[i]].first_key; --i)
+        for (int k = 0; k < int(nodes[ch[i]].op_counts.size()); ++k) above[k] += nodes[ch[i]].op_counts[k];
+      x = ch[i];
+    }
+    for (auto const &e : nodes[x].entries)
+      if (tau < e.key) above[2 * e.op.block_index + e.op.dagger]++;
+  }
+
+  void impurity_trace_wide::try_replace(configuration::oplist_t const &updated_ops) {
+    if (tree_size == 0) return;
+    for (auto const &[tau, op] : updated_ops) {
+      int x   = find_leaf(tau);
+      auto &e = nodes[x].entries;
+      auto it = std::lower_bound(e.begin(), e.end(), tau, [](entry_t const &a, time_pt const &t) { return a.key < t; });
+      if (it == e.end() || !(it->key == tau)) TRIQS_RUNTIME_ERROR << "impurity_trace_wide: no operator to replace at " << tau;
+      replaced_ops.emplace_back(x, tau, it->op);
+      it->op = op;
+      mark_modified(x);
+    }
+  }
+
+  // Undo the trial
+  void impurity_trace_wide::cancel_trial() {
+    auto find = [this](int x, time_pt const &tau) {
+      auto &e = nodes[x].entries;
+      return std::find_if(e.begin(), e.end(), [&](entry_t const &a) { return a.key == tau; });
+    };
+    for (auto const &[x, tau] : inserted_entries) nodes[x].entries.erase(find(x, tau));
+    for (auto const &[x, tau] : deleted_entries) find(x, tau)->deleted = false;
+    for (auto it = replaced_ops.rbegin(); it != replaced_ops.rend(); ++it) find(std::get<0>(*it), std::get<1>(*it))->op = std::get<2>(*it);
+
+    // restore the time spans, from the leaves up
+    sort_by_level(modified_nodes);
+    for (int x : modified_nodes) {
+      update_span(x);
+      nodes[x].modified = nodes[x].trial_tables_valid = false;
+    }
+    if (root != -1 && nodes[root].size() == 0) { // the trial was an insertion in an empty tree
+      free_node(root);
+      root = -1;
+    }
+
+    tree_size += int(deleted_entries.size()) - int(inserted_entries.size());
+    modified_nodes.clear(), inserted_entries.clear(), deleted_entries.clear(), replaced_ops.clear();
+  }
+
+  // Make the trial permanent : remove the deleted operators, rebalance the tree and update the caches.
+  // The trial caches of the modified nodes become their caches, unless their time span has changed in the process.
+  void impurity_trace_wide::confirm_trial() {
+
+    std::swap(density_matrix, accepted_density_matrix); // computed for the trial
+
+    for (int x : modified_nodes)
+      if (nodes[x].is_leaf()) std::erase_if(nodes[x].entries, [](entry_t const &e) { return e.deleted; });
+    dirty_nodes = modified_nodes;
+
+    // the leaves are first in the list, the ancestors are rebalanced with them
+    sort_by_level(modified_nodes);
+    for (int x : modified_nodes)
+      if (nodes[x].is_leaf()) rebalance(x);
+
+    sort_by_level(dirty_nodes);
+    for (int x : dirty_nodes) {
+      auto &n = nodes[x];
+      if (n.parent == -2) continue; // merged and freed
+      update_span(x);
+      // NB : the time span of a node changes if it is split or merged, or if an operator at one of its ends is removed
+      bool keep_trial = n.modified && n.trial_tables_valid && (n.trial.first_key == n.first_key) && (n.trial.last_key == n.last_key);
+      if (keep_trial)
+        std::swap(n.cache, n.trial);
+      else
+        compute_block_tables(n, n.cache);
+      n.modified = n.trial_tables_valid = false;
+    }
+    for (int x : modified_nodes) nodes[x].modified = nodes[x].trial_tables_valid = false; // the freed ones
+
+    modified_nodes.clear(), dirty_nodes.clear(), inserted_entries.clear(), deleted_entries.clear(), replaced_ops.clear();
+  }
+
+  //====== Cache ======
+
+  // Block tables and bounds of node n in c, from its entries or from the current caches of its children.
+  // The matrices are invalidated and their storage carved from the buffer.
+  void impurity_trace_wide::compute_block_tables(node_t &n, block_cache_t &c) {
+
+    c.first_key = n.first_key;
+    c.last_key  = n.last_key;
+    c.block_table.resize(n_blocks);
+    c.matrix_lnorms.resize(n_blocks);
+    c.matrix_offset.resize(n_blocks + 1);
+    c.matrix_valid.assign(n_blocks, 0);
+
+    for (int b = 0; b < n_blocks; ++b) {
+      int bc       = b;
+      double lnorm = 0;
+      if (n.is_leaf()) {
+        for (int i = 0; i < int(n.entries.size()) && bc != -1; ++i) {
+          if (i > 0) lnorm += double(n.entries[i].key - n.entries[i - 1].key) * get_block_emin(bc);
+          if (!n.entries[i].deleted) bc = get_op_block_map(n.entries[i].op, bc);
+        }
+      } else {
+        for (int i = 0; i < int(n.children.size()) && bc != -1; ++i) {
+          auto &ch = nodes[n.children[i]];
+          if (i > 0) lnorm += double(ch.first_key - nodes[n.children[i - 1]].last_key) * get_block_emin(bc);
+          auto &cc = current_cache(ch);
+          lnorm += (cc.block_table[bc] == -1 ? 0 : cc.matrix_lnorms[bc]);
+          bc = cc.block_table[bc];
+        }
+      }
+      if (std::isinf(lnorm)) lnorm = wide_double_max;
+      c.block_table[b]   = bc;
+      c.matrix_lnorms[b] = lnorm;
+    }
+
+    long offset = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      c.matrix_offset[b] = offset;
+      if (c.block_table[b] != -1) offset += long(get_block_dim(c.block_table[b])) * get_block_dim(b);
+    }
+    c.matrix_offset[n_blocks] = offset;
+    c.matrix_buffer.resize(offset);
+  }
+
+  // The matrix of block b for node x, computed and cached if necessary.
+  // precondition : b is not structurally zero for x.
+  nda::matrix_const_view<h_scalar_t> impurity_trace_wide::compute_matrix(int x, int b, int thread) {
+
+    auto &n = nodes[x];
+    auto &c = current_cache(n);
+    if (c.matrix_valid[b]) return get_cached_matrix(c, b);
+
+    auto &ws   = workspaces[thread];
+    int cur    = 0;     // the buffer of ws holding M
+    bool has_m = false; // M is the identity until the first operator
+    nda::matrix_view<h_scalar_t> M = ws.matrix(0, 0, 0);
+    int bc     = b;
+    double gap = 0; // time evolution to apply before the next factor
+
+    // M <- F * exp(-gap H) * M, with F the matrix of the next operator or child, from block bc to block bn
+    // sp : the sparse form of F, or null
+    auto apply = [&](auto const &F, int bn, csr_matrix<h_scalar_t> const *sp = nullptr) {
+      int d = get_block_dim(bc);
+      double const *e = (gap == 0 ? nullptr : ws.exp(eigenvalues.data() + block_offsets[bc], gap, d));
+      if (!has_m) { // M <- F * exp
+        M.rebind(ws.matrix(cur, F.shape()[0], d));
+        for (int i = 0; i < F.shape()[0]; ++i)
+          for (int j = 0; j < d; ++j) M(i, j) = (e ? F(i, j) * e[j] : F(i, j));
+        has_m = true;
+      } else if (sp) { // the time evolution is fused in the sparse product
+        auto P = ws.matrix(1 - cur, F.shape()[0], M.shape()[1]);
+        csr_gemm(*sp, nullptr, e, M, P);
+        M.rebind(P);
+        cur = 1 - cur;
+      } else {
+        if (e)
+          for (int i = 0; i < d; ++i)
+            for (int j = 0; j < M.shape()[1]; ++j) M(i, j) *= e[i];
+        if ((F.shape()[0] == 1) && (F.shape()[1] == 1))
+          M *= F(0, 0);
+        else {
+          auto P = ws.matrix(1 - cur, F.shape()[0], M.shape()[1]);
+          small_gemm(F, M, P);
+          M.rebind(P);
+          cur = 1 - cur;
+        }
+      }
+      bc  = bn;
+      gap = 0;
+    };
+
+    if (n.is_leaf()) {
+      for (int i = 0; i < int(n.entries.size()); ++i) {
+        auto const &en = n.entries[i];
+        if (i > 0) gap += double(en.key - n.entries[i - 1].key);
+        if (en.deleted) continue;
+        apply(get_op_block_matrix(en.op, bc), get_op_block_map(en.op, bc), get_op_block_sparse(en.op, bc));
+      }
+    } else {
+      // first the matrices of the children, which use the workspace
+      for (int ch : n.children) {
+        compute_matrix(ch, bc, thread);
+        bc = current_cache(nodes[ch]).block_table[bc];
+      }
+      bc = b;
+      for (int i = 0; i < int(n.children.size()); ++i) {
+        auto &ch = nodes[n.children[i]];
+        if (i > 0) gap += double(ch.first_key - nodes[n.children[i - 1]].last_key);
+        auto &cc = current_cache(ch);
+        apply(get_cached_matrix(cc, bc), cc.block_table[bc]);
+      }
+    }
+
+    // store M, with the remaining time evolution (after operators flagged for deletion), in the cache
+    int d  = get_block_dim(bc);
+    auto C = get_cached_matrix(c, b);
+    double const *e = (gap == 0 ? nullptr : ws.exp(eigenvalues.data() + block_offsets[bc], gap, d));
+    if (!has_m) { // only deleted operators
+      for (int i = 0; i < d; ++i)
+        for (int j = 0; j < d; ++j) C(i, j) = (i != j ? 0 : (e ? e[i] : 1));
+    } else
+      for (int i = 0; i < d; ++i)
+        for (int j = 0; j < M.shape()[1]; ++j) C(i, j) = (e ? M(i, j) * e[i] : M(i, j));
+    c.matrix_valid[b] = true;
+
+    if (use_norm_of_matrices_in_cache) {
+      double norm        = frobenius_norm(C);
+      c.matrix_lnorms[b] = (std::isfinite(-std::log(norm)) ? -std::log(norm) : wide_double_max);
+    }
+    return C;
+  }
+
+  //-------- Compute the full trace ------------------------------------------
+  // Returns MC atomic weight and reweighting = trace/(atomic weight)
+  // With use_trace_estimator, the weight is the trace of the first non zero block, as in impurity_trace::compute_trace
+  std::pair<h_scalar_t, h_scalar_t> impurity_trace_wide::compute_trace(double p_yee, double u_yee, bool estimate) {
+
+    double epsilon         = 1.e-15; // Machine precision
+    auto log_epsilon0      = -std::log(1.e-15);
+    double lnorm_threshold = wide_double_max - 100;
+    init_to_sort_lnorm_b.clear();
+    to_sort_lnorm_b.clear();
+
+    // simplifies later code
+    if (tree_size == 0) {
+      if (use_norm_as_weight) {
+        for (int bl = 0; bl < n_blocks; ++bl) { // copy in place, no reallocation
+          density_matrix[bl].is_valid = atomic_rho[bl].is_valid;
+          density_matrix[bl].mat()    = atomic_rho[bl].mat;
+        }
+        return {atomic_norm, atomic_z / atomic_norm};
+      } else
+        return {atomic_z, 1};
+    }
+
+    // Put density_matrix to "not recomputed", also for a structural 0
+    for (int bl = 0; bl < n_blocks; ++bl) density_matrix[bl].is_valid = false;
+
+    // the block tables of the modified nodes, from the leaves up
+    sort_by_level(modified_nodes);
+    for (int x : modified_nodes) {
+      auto &n = nodes[x];
+      if (!n.trial_tables_valid) compute_block_tables(n, n.trial);
+      n.trial_tables_valid = true;
+    }
+
+    // beta - tmax + tmin
+    auto &r          = nodes[root];
+    auto &rc         = current_cache(r);
+    double dtau_beta = beta - double(r.last_key);
+    double dtau_0    = double(r.first_key);
+    double dtau      = dtau_beta + dtau_0;
+
+    for (int b = 0; b < n_blocks; ++b) {
+      if (rc.block_table[b] != b) continue; // final structural check B ---> returns to B.
+      double lnorm    = rc.matrix_lnorms[b] + dtau * get_block_emin(b);
+      lnorm_threshold = std::min(lnorm_threshold, lnorm + log_epsilon0);
+      init_to_sort_lnorm_b.emplace_back(lnorm, b);
+    }
+    for (auto const &b_b : init_to_sort_lnorm_b)
+      if (b_b.first <= lnorm_threshold) to_sort_lnorm_b.push_back(b_b);
+
+    if (to_sort_lnorm_b.size() == 0) return {0.0, 1}; // structural 0
+
+    // Now sort the blocks non structurally 0 according to the bound
+    std::sort(to_sort_lnorm_b.begin(), to_sort_lnorm_b.end());
+
+    h_scalar_t full_trace = 0, estimator_trace = 0;
+    double norm_trace_sq = 0, trace_abs = 0;
+
+    int n_bl = to_sort_lnorm_b.size(); // number of blocks
+    bound_cumul.resize(n_bl + 1);      // cumulative sum of the bounds, as in impurity_trace
+    bound_cumul[n_bl] = 0;
+    for (int bl = n_bl - 1; bl >= 0; --bl)
+      bound_cumul[bl] = bound_cumul[bl + 1]
+         + std::exp(-to_sort_lnorm_b[bl].first) * (use_norm_as_weight ? 1 : std::sqrt(get_block_dim(to_sort_lnorm_b[bl].second)));
+
+    // Evaluation of the contribution of block number bl (in sorted order), on a given thread
+    auto evaluate_block = [&](int bl, int thread) {
+      int block_index = to_sort_lnorm_b[bl].second;
+      auto M          = compute_matrix(root, block_index, thread);
+
+      block_result_t res{0, 0, 0};
+      auto &ws = workspaces[thread];
+      auto dim = get_block_dim(block_index);
+      auto ev  = eigenvalues.data() + block_offsets[block_index];
+      if (use_norm_as_weight) {
+        // exp(-dtau E) = exp(-dtau_beta E) * exp(-dtau_0 E), consistent with the density matrix
+        auto &mat = density_matrix[block_index].mat;
+        for (int u = 0; u < dim; ++u)
+          for (int v = 0; v < dim; ++v) mat(u, v) = M(u, v);
+        double const *eb = ws.exp(ev, dtau_beta, dim);
+        for (int u = 0; u < dim; ++u)
+          for (int v = 0; v < dim; ++v) mat(u, v) *= eb[u];
+        double const *e0 = ws.exp(ev, dtau_0, dim);
+        for (int u = 0; u < dim; ++u)
+          for (int v = 0; v < dim; ++v) {
+            mat(u, v) *= e0[v];
+            double xx = std::abs(mat(u, v));
+            res.norm_trace_sq += xx * xx;
+          }
+        for (int u = 0; u < dim; ++u) {
+          res.trace_partial += mat(u, u);
+          res.trace_abs += std::abs(mat(u, u));
+        }
+      } else {
+        double const *e = ws.exp(ev, dtau, dim);
+        for (int u = 0; u < dim; ++u) {
+          auto x = M(u, u) * e[u];
+          res.trace_partial += x;
+          res.trace_abs += std::abs(x);
+        }
+      }
+      block_results[bl % block_results.size()] = res;
+    };
+
+    int n_per_round = (pool && blocks_connections_injective && !estimate ? pool->size() : 1);
+
+    // stopping criterion, before block bl
+    auto can_stop = [&](int bl) { return (bl > 0) && (bound_cumul[bl] <= std::abs(full_trace) * epsilon); };
+
+    // additionnal Yee quick return criterion, before block bl
+    auto yee_reject = [&](int bl) {
+      if (p_yee < 0.0) return false;
+      auto current_weight = (use_norm_as_weight ? std::sqrt(norm_trace_sq) : full_trace);
+      auto pmax           = std::abs(p_yee) * (std::abs(current_weight) + bound_cumul[bl]);
+      return pmax < u_yee; // pmax < u, we can reject
+    };
+
+    int bl    = 0;
+    bool stop = false;
+    while ((bl < n_bl) && !stop) { // sum over all blocks
+
+      if (can_stop(bl)) break;
+      if (yee_reject(bl)) return {0, 1};
+
+      int n_round = std::min(n_per_round, n_bl - bl);
+      if (n_round == 1)
+        evaluate_block(bl, 0);
+      else
+        pool->run(n_round, [&](int i, int thread) { evaluate_block(bl + i, thread); });
+
+      for (int i = 0; i < n_round; ++i, ++bl) {
+        if (i > 0) { // the criteria for the first block of the round have been checked above
+          if (can_stop(bl)) {
+            stop = true;
+            break;
+          }
+          if (yee_reject(bl)) return {0, 1};
+        }
+        auto const &res = block_results[bl % block_results.size()];
+        trace_abs += res.trace_abs;
+        if (use_norm_as_weight) {
+          density_matrix[to_sort_lnorm_b[bl].second].is_valid = true;
+          norm_trace_sq += res.norm_trace_sq;
+        }
+        full_trace += res.trace_partial; // sum for all blocks
+        if (estimator_trace == 0.0) estimator_trace = res.trace_partial;
+        if (estimate && estimator_trace != 0.0) {
+          ++bl;
+          stop = true;
+          break;
+        }
+      }
+    } // loop on block
+
+    double norm_trace = std::sqrt(norm_trace_sq);
+    if (!isfinite(full_trace)) TRIQS_RUNTIME_ERROR << " full_trace not finite" << full_trace;
+
+    // return {weight, reweighting}
+    if (use_trace_estimator) {
+      if (estimator_trace == 0.0) return {0, 1};
+      return {std::abs(estimator_trace), full_trace / std::abs(estimator_trace)};
+    }
+    if (!use_norm_as_weight) return {full_trace, 1};
+    // else determine reweighting
+    auto rw = full_trace / norm_trace;
+    if (!isfinite(rw)) rw = 1;
+    return {norm_trace, rw};
+  }
+
+  /// Stream insertion
+  std::ostream &operator<<(std::ostream &out, impurity_trace_wide const &imp_trace) {
+    out << "Impurity trace (B-tree): size = " << imp_trace.tree_size << "\n";
+    std::function<void(int, int)> print = [&](int x, int indent) {
+      auto const &n = imp_trace.nodes[x];
+      out << std::string(indent, ' ') << "[" << double(n.first_key) << ", " << double(n.last_key) << "]";
+      if (n.is_leaf())
+        for (auto const &e : n.entries) out << " " << double(e.key) << (e.deleted ? "(deleted)" : "");
+      out << "\n";
+      for (int c : n.children) print(c, indent + 2);
+    };
+    if (imp_trace.root != -1) print(imp_trace.root, 0);
+    return out;
+  }
+} // namespace triqs_cthyb
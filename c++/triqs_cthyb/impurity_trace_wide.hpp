@@ -0,0 +1,288 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include "./configuration.hpp"
+#include "./parameters.hpp"
+#include "./thread_pool.hpp"
+#include "./small_gemm.hpp"
+#include "./sparse_matrix.hpp"
+#include "./vexp.hpp"
+#include "triqs/utility/rbt.hpp"
+#include <triqs/stat/histograms.hpp>
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <deque>
+#include <tuple>
+
+namespace triqs_cthyb {
+
+  /********************************************
+ Calculate the trace of the impurity problem, on a B-tree.
+
+ Same interface as impurity_trace, which uses a binary (red black) tree : see qmc_data.hpp for the choice of the engine.
+ The operators are stored in the leaves, in increasing time, by max_fanout at most.
+ An internal node has at most max_fanout children, and all leaves are at the same depth.
+ Each node caches, for all blocks, the product of the operators and time evolutions of its time span.
+ A modification touches a single leaf and its ancestors : fewer and shallower nodes than the binary tree.
+ ********************************************/
+  class impurity_trace_wide {
+
+    double beta;
+    bool use_norm_as_weight;
+    bool measure_density_matrix;
+    bool use_trace_estimator;
+
+    public:
+    // construct from the diagonalization of h_loc, and parameters
+    impurity_trace_wide(double beta, atom_diag const &h_diag, histo_map_t *hist_map, bool use_norm_as_weight = false,
+                        bool measure_density_matrix = false, bool performance_analysis = false, int n_threads = 1,
+                        bool use_trace_estimator = false, bool use_state_propagation = false, double state_propagation_cutoff = 1.e-12,
+                        bool use_float_estimates = false);
+
+    // {weight, reweighting}, as in impurity_trace
+    std::pair<h_scalar_t, h_scalar_t> compute(double p_yee = -1, double u_yee = 0) { return compute_trace(p_yee, u_yee, use_trace_estimator); }
+    std::pair<h_scalar_t, h_scalar_t> compute_full() { return compute_trace(-1, 0, false); }
+
+    // ------- h_loc data ----------------
+
+    const atom_diag *h_diag;                                      // access to the diagonalization of h_loc
+    const int n_blocks    = h_diag->n_subspaces();                //
+    const int n_eigstates = h_diag->get_full_hilbert_space_dim(); // size of the hilbert space
+
+    // ------- Trace data ----------------
+
+    private:
+    struct bool_and_matrix {
+      bool is_valid;
+      matrix<h_scalar_t> mat;
+    };
+    std::vector<bool_and_matrix> density_matrix; // density_matrix, by block, with a bool to say if it has been recomputed
+    std::vector<bool_and_matrix> accepted_density_matrix; // the same for the accepted configuration, swapped on confirmation
+    std::vector<bool_and_matrix> atomic_rho;     // atomic density matrix (non-normalized)
+    double atomic_z;                             // atomic partition function
+    double atomic_norm;                          // Frobenius norm of atomic_rho
+
+    public:
+    // The density matrix of the accepted configuration : the trials leave it untouched
+    std::vector<bool_and_matrix> const &get_density_matrix() const { return accepted_density_matrix; }
+
+    int tree_size = 0; // number of operators, +/- the added/deleted ones during a trial
+
+    // ------------------ Tree data ----------------
+
+    private:
+    static constexpr int max_fanout = 8;              // maximal number of operators of a leaf, of children of a node
+    static constexpr int min_fanout = max_fanout / 2; // below, a node is merged with a sibling on confirmation
+
+    struct entry_t {
+      time_pt key;
+      op_desc op;
+      bool deleted = false; // flagged for deletion in the current trial
+    };
+
+    // block tables, bounds and matrices of all blocks for the time span of a node
+    struct block_cache_t {
+      time_pt first_key, last_key;       // the time span for which they are computed
+      std::vector<int> block_table;      // block -> image by the product, -1 if structurally zero
+      std::vector<double> matrix_lnorms; // -ln(norm(matrix)), bound
+      std::vector<char> matrix_valid;    // is the matrix computed ?
+      std::vector<long> matrix_offset;   // position of the matrix of each block in matrix_buffer
+      std::vector<h_scalar_t> matrix_buffer;
+    };
+
+    struct node_t {
+      int parent = -1;
+      int level  = 0;                 // 0 for the leaves
+      std::vector<entry_t> entries;   // leaf : the operators, in increasing time
+      std::vector<int> children;      // internal node : the children, in increasing time
+      time_pt first_key, last_key;    // time span of the node (deleted operators included)
+      int n_ops = 0;                  // number of operators of the subtree (deleted operators included)
+      std::vector<int> op_counts;     // the same by (block_index, dagger), at [2 * block_index + dagger]
+      bool modified            = false; // its operators have changed in the current trial
+      bool trial_tables_valid  = false; // the trial block tables have been computed by compute
+      block_cache_t cache, trial;     // for the tree as confirmed, for the tree of the current trial (modified nodes)
+      bool is_leaf() const { return level == 0; }
+      int size() const { return is_leaf() ? entries.size() : children.size(); }
+      int count(int block_index, bool dagger) const {
+        int k = 2 * block_index + dagger;
+        return (k < int(op_counts.size()) ? op_counts[k] : 0);
+      }
+    };
+
+    std::deque<node_t> nodes; // a deque : references to the nodes stay valid when it grows
+    std::vector<int> free_nodes;
+    int root = -1; // -1 for an empty tree
+
+    std::vector<atom_diag::op_block_mat_t> aux_operators;
+
+    // ------------------ Trial data ----------------
+
+    std::vector<int> modified_nodes;                           // the nodes modified by the current trial
+    std::vector<std::pair<int, time_pt>> inserted_entries;     // leaf, key
+    std::vector<std::pair<int, time_pt>> deleted_entries;      // leaf, key
+    std::vector<std::tuple<int, time_pt, op_desc>> replaced_ops; // leaf, key, former operator
+    std::vector<int> dirty_nodes;                              // to be updated on confirmation
+
+    // ------------------ Helpers ----------------
+
+    int get_block_dim(int b) const { return h_diag->get_subspace_dim(b); }
+    double get_block_emin(int b) const { return h_diag->get_eigenvalue(b, 0); }
+
+    // The connections of the operators, flattened by (operator, block) as [op * n_blocks + b], -1 for no connection
+    std::vector<int> c_block_maps, cdag_block_maps, aux_block_maps;
+    void add_block_maps(std::vector<int> &v, auto const &get_connection) {
+      for (int b = 0; b < n_blocks; ++b) v.push_back(get_connection(b));
+    }
+
+    // block -> image of the block by the operator op
+    int get_op_block_map(op_desc const &op, int b) const {
+      long i = op.linear_index;
+      if (i < 0) return aux_block_maps[(-i - 1) * n_blocks + b];
+      return (op.dagger ? cdag_block_maps : c_block_maps)[i * n_blocks + b];
+    }
+
+    // the matrix of op, from block b to its image
+    matrix<h_scalar_t> const &get_op_block_matrix(op_desc const &op, int b) const {
+      if (op.linear_index >= 0) return (op.dagger ? h_diag->cdag_matrix(op.linear_index, b) : h_diag->c_matrix(op.linear_index, b));
+      return aux_operators[-op.linear_index - 1].block_mat[b];
+    }
+
+    // The block matrices of the operators in sparse form, by (operator, block), when they are sparse enough (see sparse_form)
+    std::vector<std::optional<csr_matrix<h_scalar_t>>> sparse_c, sparse_cdag, sparse_aux;
+    void add_sparse_forms(std::vector<std::optional<csr_matrix<h_scalar_t>>> &v, auto const &get_matrix, auto const &get_connection) {
+      for (int b = 0; b < n_blocks; ++b)
+        v.push_back(get_connection(b) == -1 ? std::nullopt : sparse_form(get_matrix(b)));
+    }
+
+    // the sparse form of the matrix of op from block b, null if it is not sparse
+    csr_matrix<h_scalar_t> const *get_op_block_sparse(op_desc const &op, int b) const {
+      long i  = op.linear_index;
+      auto &v = (i < 0 ? sparse_aux : (op.dagger ? sparse_cdag : sparse_c));
+      auto &s = v[(i < 0 ? -i - 1 : i) * n_blocks + b];
+      return (s ? &*s : nullptr);
+    }
+
+    // all eigenvalues, block after block, and the position of each block
+    std::vector<double> eigenvalues;
+    std::vector<int> block_offsets;
+
+    // the cache of n for the current trial : its trial cache if it is modified
+    block_cache_t &current_cache(node_t &n) { return n.modified ? n.trial : n.cache; }
+
+    // The cached matrix of block b
+    nda::matrix_view<h_scalar_t> get_cached_matrix(block_cache_t &c, int b) const {
+      return nda::matrix_view<h_scalar_t>{std::array<long, 2>{get_block_dim(c.block_table[b]), get_block_dim(b)},
+                                          c.matrix_buffer.data() + c.matrix_offset[b]};
+    }
+
+    // tree structure
+    int new_node(int level);
+    void free_node(int x);
+    int find_leaf(time_pt const &key) const;
+    void update_span(int x);
+    void mark_modified(int leaf);
+    void split(int x);
+    void merge_with_sibling(int x);
+    void rebalance(int x);
+    void sort_by_level(std::vector<int> &v) const;
+
+    // cache
+    void compute_block_tables(node_t &n, block_cache_t &c);
+    nda::matrix_const_view<h_scalar_t> compute_matrix(int x, int b, int thread);
+    void cancel_trial();
+    void confirm_trial();
+
+    bool use_norm_of_matrices_in_cache = true; // When a matrix is computed in cache, its norm replaces the norm estimate
+
+    // The trace, or its estimate if estimate is true (see impurity_trace)
+    std::pair<h_scalar_t, h_scalar_t> compute_trace(double p_yee, double u_yee, bool estimate);
+
+    // ---------------- Workspaces of compute ----------------
+    // The children of a node are computed before the product, so one workspace per thread is enough
+    struct workspace_t {
+      std::vector<h_scalar_t> buffers[2];
+      std::vector<double> exp_factors;
+      // a n_rows x n_cols matrix in buffer i
+      nda::matrix_view<h_scalar_t> matrix(int i, long n_rows, long n_cols) {
+        auto &buf = buffers[i];
+        if (long(buf.size()) < n_rows * n_cols) buf.resize(n_rows * n_cols);
+        return nda::matrix_view<h_scalar_t>{std::array<long, 2>{n_rows, n_cols}, buf.data()};
+      }
+      // exp(-dtau E) for the eigenvalues e of a block
+      double const *exp(double const *e, double dtau, int dim) {
+        if (int(exp_factors.size()) < dim) exp_factors.resize(dim);
+        exp_neg_scaled(e, dtau, exp_factors.data(), dim);
+        return exp_factors.data();
+      }
+    };
+    std::vector<workspace_t> workspaces; // by thread
+
+    std::vector<std::pair<double, int>> init_to_sort_lnorm_b, to_sort_lnorm_b; // pairs of lnorm and b to sort in order of bound
+    std::vector<double> bound_cumul;                                           // cumulative sum of the bounds
+
+    // ---------------- Parallel evaluation of the blocks ----------------
+    // As in impurity_trace : by rounds of n_threads blocks, when the connections between blocks are one-to-one
+    struct block_result_t {
+      h_scalar_t trace_partial;
+      double trace_abs, norm_trace_sq;
+    };
+    std::unique_ptr<thread_pool> pool;         // null for a serial evaluation
+    std::vector<block_result_t> block_results; // results of the blocks of the current round
+    bool blocks_connections_injective = true;  // false if an auxiliary operator maps two blocks to the same block
+
+    public:
+    // attach auxiliary operators
+    op_desc attach_aux_operator(many_body_op_t const &op);
+
+    /*************************************************************************
+     * Insertion, removal, replacement : the trial is done in place and undone on cancellation.
+     * The tree is rebalanced on confirmation only.
+     *************************************************************************/
+
+    // Put a trial operator op at tau
+    void try_insert(time_pt const &tau, op_desc const &op);
+    void cancel_insert() { cancel_trial(); }
+    void confirm_insert() { confirm_trial(); }
+
+    // Find and flag for deletion the nth operator with fixed dagger and block_index, in decreasing time
+    // n=0 : first operator, n=1, second, etc...
+    time_pt try_delete(int n, int block_index, bool dagger);
+
+    // The nth operator of the configuration, in decreasing time
+    std::pair<time_pt, op_desc> get_operator(int n) const;
+
+    // The numbers of operators by (block_index, dagger), at [2 * block_index + dagger] : above, at times larger than tau, and in total
+    void count_operators(time_pt const &tau, std::vector<int> &above, std::vector<int> &total) const;
+    void cancel_delete() { cancel_trial(); }
+    void confirm_delete() { confirm_trial(); }
+
+    // No try_shift implemented. Use combination of try_insert and try_delete instead.
+    void cancel_shift() { cancel_trial(); }
+    void confirm_shift() { confirm_trial(); }
+
+    // Replace the operators according to a substitution table
+    void try_replace(configuration::oplist_t const &updated_ops);
+    void confirm_replace() { confirm_trial(); }
+    void cancel_replace() { cancel_trial(); }
+
+    /// Stream insertion
+    friend std::ostream &operator<<(std::ostream &out, impurity_trace_wide const &imp_trace);
+  };
+} // namespace triqs_cthyb
@@ -0,0 +1,453 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#include "./insertion_trace.hpp"
+#include <triqs/utility/exceptions.hpp>
+#include <algorithm>
+
+namespace triqs_cthyb {
+
+  insertion_trace::insertion_trace(double beta, atom_diag const &h_diag_) : beta(beta), h_diag(&h_diag_), n_blocks(h_diag_.n_subspaces()) {
+    for (int bl = 0; bl < n_blocks; ++bl) {
+      block_offsets.push_back(eigenvalues.size());
+      for (int u = 0; u < get_block_dim(bl); ++u) eigenvalues.push_back(h_diag->get_eigenvalue(bl, u));
+    }
+    needed.resize(n_blocks);
+  }
+
+  int insertion_trace::attach_operator(many_body_op_t const &op) {
+    operators.push_back(h_diag->get_op_mat(op));
+    return operators.size() - 1;
+  }
+
+  // -------- Products for all blocks --------
+
+  void insertion_trace::set_identity(block_product_t &p) {
+    p.block_table.resize(n_blocks);
+    p.offsets.resize(n_blocks);
+    long offset = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      p.block_table[b] = b;
+      p.offsets[b]     = offset;
+      offset += long(get_block_dim(b)) * get_block_dim(b);
+    }
+    p.buffer.assign(offset, 0);
+    for (int b = 0; b < n_blocks; ++b) {
+      auto M = get_matrix(p, b);
+      for (int u = 0; u < get_block_dim(b); ++u) M(u, u) = 1;
+    }
+  }
+
+  void insertion_trace::evolve_rows(nda::matrix_view<h_scalar_t> M, int b, double dtau) {
+    if (dtau == 0) return;
+    int d = get_block_dim(b);
+    if (int(exp_factors.size()) < d) exp_factors.resize(d);
+    exp_neg_scaled(eigenvalues.data() + block_offsets[b], dtau, exp_factors.data(), d);
+    for (int i = 0; i < d; ++i)
+      for (int j = 0; j < M.shape()[1]; ++j) M(i, j) *= exp_factors[i];
+  }
+
+  void insertion_trace::multiply_left(block_product_t &p, double dtau, int k, block_product_t &q, std::vector<char> const *needed) {
+    q.block_table.resize(n_blocks);
+    q.offsets.resize(n_blocks);
+    long offset = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      int pb           = p.block_table[b];
+      int qb           = ((pb == -1) || (needed && !(*needed)[b]) ? -1 : get_op_block_map(k, pb));
+      q.block_table[b] = qb;
+      q.offsets[b]     = offset;
+      if (qb != -1) offset += long(get_block_dim(qb)) * get_block_dim(b);
+    }
+    q.buffer.resize(offset);
+
+    for (int b = 0; b < n_blocks; ++b) {
+      if (q.block_table[b] == -1) continue;
+      int pb = p.block_table[b];
+      auto P = get_matrix(p, b);
+      auto T = ws_matrix(0, P.shape()[0], P.shape()[1]);
+      T      = P;
+      evolve_rows(T, pb, dtau);
+      auto Q = get_matrix(q, b);
+      small_gemm(get_op_block_matrix(k, pb), T, Q);
+    }
+  }
+
+  void insertion_trace::multiply_right(block_product_t &p, double dtau, int k, block_product_t &q) {
+    q.block_table.resize(n_blocks);
+    q.offsets.resize(n_blocks);
+    long offset = 0;
+    for (int c = 0; c < n_blocks; ++c) {
+      int cp           = get_op_block_map(k, c);
+      int qb           = (cp == -1 ? -1 : p.block_table[cp]);
+      q.block_table[c] = qb;
+      q.offsets[c]     = offset;
+      if (qb != -1) offset += long(get_block_dim(qb)) * get_block_dim(c);
+    }
+    q.buffer.resize(offset);
+
+    for (int c = 0; c < n_blocks; ++c) {
+      if (q.block_table[c] == -1) continue;
+      int cp       = get_op_block_map(k, c);
+      auto const &F = get_op_block_matrix(k, c);
+      auto T        = ws_matrix(0, F.shape()[0], F.shape()[1]);
+      T             = F;
+      evolve_rows(T, cp, dtau);
+      auto Q = get_matrix(q, c);
+      small_gemm(get_matrix(p, cp), T, Q);
+    }
+  }
+
+  void insertion_trace::set_zero(block_product_t &p) {
+    p.block_table.assign(n_blocks, -1);
+    p.offsets.assign(n_blocks, 0);
+    p.buffer.clear();
+  }
+
+  void insertion_trace::apply_operator(atom_diag::op_block_mat_t const &op, block_product_t &p, block_product_t &q) {
+    q.block_table.resize(n_blocks);
+    q.offsets.resize(n_blocks);
+    long offset = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      int pb           = p.block_table[b];
+      int qb           = (pb == -1 ? -1 : op.connection(pb));
+      q.block_table[b] = qb;
+      q.offsets[b]     = offset;
+      if (qb != -1) offset += long(get_block_dim(qb)) * get_block_dim(b);
+    }
+    q.buffer.resize(offset);
+
+    for (int b = 0; b < n_blocks; ++b) {
+      if (q.block_table[b] == -1) continue;
+      auto Q = get_matrix(q, b);
+      small_gemm(op.block_mat[p.block_table[b]], get_matrix(p, b), Q);
+    }
+  }
+
+  void insertion_trace::add_product(block_product_t &p, h_scalar_t c, block_product_t &q) {
+    bool same_table = true;
+    for (int b = 0; b < n_blocks; ++b) {
+      int pb = p.block_table[b], qb = q.block_table[b];
+      if ((pb != -1) && (qb != -1) && (pb != qb))
+        TRIQS_RUNTIME_ERROR << "insertion_trace : the operators do not preserve the block structure of the products";
+      same_table = same_table && (pb == qb || qb == -1);
+    }
+
+    // a block of q not yet in p : copy p into the layout of both
+    if (!same_table) {
+      sum_tmp.block_table.resize(n_blocks);
+      sum_tmp.offsets.resize(n_blocks);
+      long offset = 0;
+      for (int b = 0; b < n_blocks; ++b) {
+        int sb                 = (p.block_table[b] != -1 ? p.block_table[b] : q.block_table[b]);
+        sum_tmp.block_table[b] = sb;
+        sum_tmp.offsets[b]     = offset;
+        if (sb != -1) offset += long(get_block_dim(sb)) * get_block_dim(b);
+      }
+      sum_tmp.buffer.assign(offset, 0);
+      for (int b = 0; b < n_blocks; ++b)
+        if (p.block_table[b] != -1) get_matrix(sum_tmp, b) = get_matrix(p, b);
+      std::swap(p, sum_tmp);
+    }
+
+    for (int b = 0; b < n_blocks; ++b) {
+      if (q.block_table[b] == -1) continue;
+      auto P = get_matrix(p, b);
+      auto Q = get_matrix(q, b);
+      for (int u = 0; u < P.shape()[0]; ++u)
+        for (int v = 0; v < P.shape()[1]; ++v) P(u, v) += c * Q(u, v);
+    }
+  }
+
+  // -------- Environments --------
+
+  h_scalar_t insertion_trace::set_configuration(configuration const &config) {
+
+    // the configuration is in decreasing time
+    times.clear(), ops.clear();
+    for (auto const &[t, op] : config) times.push_back(t), ops.push_back(op);
+    std::reverse(times.begin(), times.end());
+    std::reverse(ops.begin(), ops.end());
+    int n = times.size();
+    taus.resize(n + 2);
+    taus[0] = 0;
+    for (int k = 0; k < n; ++k) taus[k + 1] = double(times[k]);
+    taus[n + 1] = beta;
+
+    right_env.resize(n + 1);
+    left_env.resize(n + 1);
+    set_identity(right_env[0]);
+    for (int i = 1; i <= n; ++i) multiply_left(right_env[i - 1], taus[i] - taus[i - 1], i - 1, right_env[i]);
+    set_identity(left_env[n]);
+    for (int j = n - 1; j >= 0; --j) multiply_right(left_env[j + 1], taus[j + 2] - taus[j + 1], j, left_env[j]);
+
+    // the trace, from the right environment of the last operator
+    h_scalar_t tr = 0;
+    for (int b = 0; b < n_blocks; ++b) {
+      if (right_env[n].block_table[b] != b) continue;
+      auto M = get_matrix(right_env[n], b);
+      int d  = get_block_dim(b);
+      if (int(exp_factors.size()) < d) exp_factors.resize(d);
+      exp_neg_scaled(eigenvalues.data() + block_offsets[b], beta - taus[n], exp_factors.data(), d);
+      for (int u = 0; u < d; ++u) tr += M(u, u) * exp_factors[u];
+    }
+    return tr;
+  }
+
+  // -------- Insertions --------
+
+  template <typename Times, typename Mark, typename Evaluate>
+  void insertion_trace::sweep(int n_samples, Times const &get_times, Mark const &mark, Evaluate const &evaluate) {
+
+    // the interval of tau between two operators of the configuration, -1 if tau is the time of one of them
+    auto interval = [&](time_pt const &tau) {
+      int i = std::lower_bound(times.begin(), times.end(), tau) - times.begin();
+      return ((i < int(times.size())) && (times[i] == tau) ? -1 : i);
+    };
+
+    order.clear();
+    for (int s = 0; s < n_samples; ++s) {
+      auto const &[tau1, tau2] = get_times(s);
+      int i1 = interval(tau1), i2 = interval(tau2);
+      if ((i1 == -1) || (i2 == -1) || (tau1 == tau2)) continue;
+      if (tau1 < tau2)
+        order.push_back({i1, i2, s});
+      else
+        order.push_back({i2, i1, s});
+    }
+    std::sort(order.begin(), order.end());
+
+    for (int g = 0; g < int(order.size());) {
+      int i = order[g][0], g_end = g;
+      while ((g_end < int(order.size())) && (order[g_end][0] == i)) ++g_end;
+
+      // the blocks after the earlier operator, the only ones needed in the product of the operators between the two
+      std::fill(needed.begin(), needed.end(), 0);
+      mark(i, g, g_end);
+
+      int cur = 0;
+      set_identity(mid[cur]);
+      for (int j = i; g < g_end; ++j) {
+        if (j > i) { // add the operator j
+          multiply_left(mid[cur], (j == i + 1 ? 0 : taus[j] - taus[j - 1]), j - 1, mid[1 - cur], &needed);
+          cur = 1 - cur;
+        }
+        for (; (g < g_end) && (order[g][1] == j); ++g) evaluate(order[g][2], i, j, mid[cur]);
+      }
+    }
+  }
+
+  void insertion_trace::mark_needed(atom_diag::op_block_mat_t const &op, int i) {
+    for (int b0 = 0; b0 < n_blocks; ++b0) {
+      int bx = right_env[i].block_table[b0];
+      if ((bx != -1) && (op.connection(bx) != -1)) needed[op.connection(bx)] = 1;
+    }
+  }
+
+  nda::matrix_view<h_scalar_t> insertion_trace::earlier_product(int i, int j, block_product_t &mid, int b0, atom_diag::op_block_mat_t const &op_a,
+                                                                double tau_a, double tau_b) {
+    int bx = right_env[i].block_table[b0], ca = op_a.connection(bx), cm = (i < j ? mid.block_table[ca] : ca);
+    int d0 = get_block_dim(b0), cur = 0;
+    auto X = get_matrix(right_env[i], b0);
+    auto M = ws_matrix(cur, X.shape()[0], d0);
+    M      = X;
+    evolve_rows(M, bx, tau_a - taus[i]);
+    auto apply = [&](auto const &F, int b_out, double dtau) { // M <- exp(-dtau H) * F * M
+      auto P = ws_matrix(1 - cur, F.shape()[0], d0);
+      small_gemm(F, M, P);
+      evolve_rows(P, b_out, dtau);
+      M.rebind(P);
+      cur = 1 - cur;
+    };
+    if (i < j) {
+      apply(op_a.block_mat[bx], ca, taus[i + 1] - tau_a);
+      apply(get_matrix(mid, ca), cm, tau_b - taus[j]);
+    } else
+      apply(op_a.block_mat[bx], ca, tau_b - tau_a);
+    return M;
+  }
+
+  void insertion_trace::compute(std::vector<insertion_t> &insertions) {
+
+    for (auto &x : insertions) x.trace = 0;
+    auto get_times = [&](int s) { return std::make_pair(insertions[s].tau1, insertions[s].tau2); };
+    auto earlier_op = [&](insertion_t const &x) -> auto const & { return operators[x.tau1 < x.tau2 ? x.op1 : x.op2]; };
+
+    // The trace of insertion s, with the earlier operator in interval i and the later one in interval j.
+    // mid : the product of the operators from i + 1 to j, if i < j
+    auto evaluate = [&](int s, int i, int j, block_product_t &mid) {
+      auto &x         = insertions[s];
+      bool first_is_1 = (x.tau1 < x.tau2);
+      double tau_a = double(first_is_1 ? x.tau1 : x.tau2), tau_b = double(first_is_1 ? x.tau2 : x.tau1);
+      auto const &op_a = earlier_op(x);
+      auto const &op_b = operators[first_is_1 ? x.op2 : x.op1];
+
+      for (int b0 = 0; b0 < n_blocks; ++b0) {
+        int bx = right_env[i].block_table[b0];
+        if (bx == -1) continue;
+        int ca = op_a.connection(bx);
+        if (ca == -1) continue;
+        int cm = (i < j ? mid.block_table[ca] : ca);
+        if (cm == -1) continue;
+        int cb = op_b.connection(cm);
+        if ((cb == -1) || (left_env[j].block_table[cb] != b0)) continue;
+
+        // W = exp * op_b * exp * mid * exp * op_a * exp * right_env
+        auto M = earlier_product(i, j, mid, b0, op_a, tau_a, tau_b);
+        int d0 = get_block_dim(b0);
+        auto W = ws_matrix(2, get_block_dim(cb), d0);
+        small_gemm(op_b.block_mat[cm], M, W);
+        evolve_rows(W, cb, taus[j + 1] - tau_b);
+
+        // Tr(left_env * W)
+        auto L = get_matrix(left_env[j], cb);
+        for (int u = 0; u < d0; ++u)
+          for (int v = 0; v < L.shape()[1]; ++v) x.trace += L(u, v) * W(v, u);
+      }
+    };
+
+    auto mark_earlier = [&](int i, int g, int g_end) {
+      for (int h = g; h < g_end; ++h) mark_needed(earlier_op(insertions[order[h][2]]), i);
+    };
+    sweep(insertions.size(), get_times, mark_earlier, evaluate);
+  }
+
+  void insertion_trace::compute_all_pairs(std::vector<std::pair<time_pt, time_pt>> const &samples, std::vector<h_scalar_t> &traces) {
+
+    int n_ops = operators.size();
+    traces.assign(samples.size() * n_ops * n_ops, 0);
+    auto get_times = [&](int s) { return samples[s]; };
+
+    // The traces of sample s for all pairs, with the earlier time in interval i and the later one in interval j.
+    // For a start block, the product up to the later time is computed once per earlier operator,
+    // and the product from the later time to beta once per later operator and block of the earlier product.
+    auto evaluate = [&](int s, int i, int j, block_product_t &mid) {
+      auto const &[tau1, tau2] = samples[s];
+      bool first_is_1          = (tau1 < tau2);
+      double tau_a = double(first_is_1 ? tau1 : tau2), tau_b = double(first_is_1 ? tau2 : tau1);
+      h_scalar_t *tr = traces.data() + long(s) * n_ops * n_ops;
+
+      for (int b0 = 0; b0 < n_blocks; ++b0) {
+        int bx = right_env[i].block_table[b0];
+        if (bx == -1) continue;
+        int d0 = get_block_dim(b0);
+
+        // the products up to the later time, for all earlier operators e : {block cm, e, offset in earlier_buffer}
+        earlier.clear();
+        earlier_buffer.clear();
+        for (int e = 0; e < n_ops; ++e) {
+          int ca = operators[e].connection(bx);
+          if (ca == -1) continue;
+          int cm = (i < j ? mid.block_table[ca] : ca);
+          if (cm == -1) continue;
+          auto M = earlier_product(i, j, mid, b0, operators[e], tau_a, tau_b);
+          earlier.push_back({cm, e, int(earlier_buffer.size())});
+          earlier_buffer.insert(earlier_buffer.end(), M.data(), M.data() + M.size());
+        }
+        std::sort(earlier.begin(), earlier.end());
+
+        for (int g = 0; g < int(earlier.size());) {
+          int cm = earlier[g][0], g_end = g, dm = get_block_dim(cm);
+          while ((g_end < int(earlier.size())) && (earlier[g_end][0] == cm)) ++g_end;
+
+          for (int l = 0; l < n_ops; ++l) {
+            int cb = operators[l].connection(cm);
+            if ((cb == -1) || (left_env[j].block_table[cb] != b0)) continue;
+
+            // N = left_env * exp * op_l
+            auto const &F = operators[l].block_mat[cm];
+            auto T        = ws_matrix(2, F.shape()[0], F.shape()[1]);
+            T             = F;
+            evolve_rows(T, cb, taus[j + 1] - tau_b);
+            auto N = ws_matrix(0, d0, dm);
+            small_gemm(get_matrix(left_env[j], cb), T, N);
+
+            // Tr(N * M_e), the earlier operator at tau_a and the later one at tau_b
+            for (int h = g; h < g_end; ++h) {
+              int e                = earlier[h][1];
+              h_scalar_t const *Me = earlier_buffer.data() + earlier[h][2];
+              h_scalar_t t         = 0;
+              for (int u = 0; u < d0; ++u)
+                for (int v = 0; v < dm; ++v) t += N(u, v) * Me[v * d0 + u];
+              tr[first_is_1 ? e * n_ops + l : l * n_ops + e] += t;
+            }
+          }
+          g = g_end;
+        }
+      }
+    };
+
+    auto mark_all = [&](int i, int, int) {
+      for (auto const &op : operators) mark_needed(op, i);
+    };
+    sweep(samples.size(), get_times, mark_all, evaluate);
+  }
+
+  // -------- Integrated insertions --------
+
+  void insertion_trace::integrate_all_pairs(std::vector<h_scalar_t> &integrals) {
+
+    int n = ops.size(), n_ops = operators.size();
+    sums_1.resize(n_ops);
+    sums_2.resize(n_ops * n_ops);
+    for (auto &p : sums_1) set_zero(p);
+    for (auto &p : sums_2) set_zero(p);
+
+    // Interval s, of length l, from the operator s - 1 to s. With R the product up to the operator s - 1 :
+    //   sums_2[e, l] += l * O_l * (sums_1[e] + l / 2 * O_e * R)    (l^2 / 2 : both operators in the interval, e first)
+    //   sums_1[e]    += l * O_e * R
+    // then all the sums are multiplied by the operator s and the evolution over the interval.
+    for (int s = 0; s <= n; ++s) {
+      double l = taus[s + 1] - taus[s];
+      for (int e = 0; e < n_ops; ++e) {
+        apply_operator(operators[e], right_env[s], op_right_env);
+        half_sum = sums_1[e];
+        add_product(half_sum, l / 2, op_right_env);
+        for (int k = 0; k < n_ops; ++k) {
+          apply_operator(operators[k], half_sum, product);
+          add_product(sums_2[e * n_ops + k], l, product);
+        }
+        add_product(sums_1[e], l, op_right_env);
+      }
+      if (s == n) break;
+      for (auto &p : sums_1) multiply_left(p, l, s, product), std::swap(p, product);
+      for (auto &p : sums_2) multiply_left(p, l, s, product), std::swap(p, product);
+    }
+
+    // the traces, with the evolution from the last operator to beta
+    integrals.assign(n_ops * n_ops, 0);
+    for (int e = 0; e < n_ops; ++e)
+      for (int k = 0; k < n_ops; ++k) {
+        auto &p       = sums_2[e * n_ops + k];
+        h_scalar_t tr = 0;
+        for (int b = 0; b < n_blocks; ++b) {
+          if (p.block_table[b] != b) continue;
+          auto M = get_matrix(p, b);
+          int d  = get_block_dim(b);
+          if (int(exp_factors.size()) < d) exp_factors.resize(d);
+          exp_neg_scaled(eigenvalues.data() + block_offsets[b], beta - taus[n], exp_factors.data(), d);
+          for (int u = 0; u < d; ++u) tr += M(u, u) * exp_factors[u];
+        }
+        // e before k : the operator a = e at the earlier time tau1 and b = k at tau2, and the converse
+        integrals[e * n_ops + k] += tr;
+        integrals[k * n_ops + e] += tr;
+      }
+  }
+
+} // namespace triqs_cthyb
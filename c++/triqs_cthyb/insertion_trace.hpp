@@ -0,0 +1,163 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include "./configuration.hpp"
+#include "./parameters.hpp"
+#include "./small_gemm.hpp"
+#include "./vexp.hpp"
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  /**
+   * The traces of a configuration with two more operators inserted, for many insertion times at once.
+   *
+   * The products of the operators of the configuration from tau = 0 up to each of them (right environments),
+   * and from each of them up to beta (left environments) are computed once per configuration.
+   * The insertions are grouped by the interval between two operators of the earlier one. For a group, the product of the
+   * operators between the two insertions is extended from one interval to the next.
+   * An insertion then costs three small products per block, instead of the evaluation of the trace of a new configuration.
+   */
+  class insertion_trace {
+
+    public:
+    insertion_trace(double beta, atom_diag const &h_diag);
+
+    /// Add an operator to insert. Returns its index.
+    int attach_operator(many_body_op_t const &op);
+
+    /// Compute the environments of the configuration. Returns its trace.
+    h_scalar_t set_configuration(configuration const &config);
+
+    /// The insertion of the operators of indices op1 at tau1 and op2 at tau2 (see attach_operator), and the resulting trace
+    struct insertion_t {
+      time_pt tau1, tau2;
+      int op1, op2;
+      h_scalar_t trace = 0;
+    };
+
+    /// Compute the traces of the configuration with the insertions. The trace is 0 when an insertion time is already taken.
+    void compute(std::vector<insertion_t> &insertions);
+
+    /**
+     * Compute the traces of the configuration with all pairs of the attached operators inserted at the times of each sample.
+     * traces[(s * n + a) * n + b] : the operator a at the first time of sample s and b at the second one, n operators.
+     * The products from the earlier time to tau = 0 and from the later one to beta are shared by all pairs.
+     */
+    void compute_all_pairs(std::vector<std::pair<time_pt, time_pt>> const &samples, std::vector<h_scalar_t> &traces);
+
+    /**
+     * For attached operators commuting with the local Hamiltonian, the integrals over tau1 and tau2 in [0, beta)
+     * of the trace of the configuration with the operator a at tau1 and b at tau2, time ordered.
+     * integrals[a * n + b], n operators.
+     *
+     * An operator commuting with H gives the same product anywhere between two operators of the configuration.
+     * The products with one operator inserted, weighted by the length of its interval, and with two operators are summed
+     * in one pass from tau = 0 to beta : the cost is linear in the number of operators of the configuration.
+     */
+    void integrate_all_pairs(std::vector<h_scalar_t> &integrals);
+
+    private:
+    double beta;
+    atom_diag const *h_diag;
+    int n_blocks;
+    std::vector<double> eigenvalues; // all eigenvalues, block after block
+    std::vector<int> block_offsets;  // the position of each block in eigenvalues
+    std::vector<atom_diag::op_block_mat_t> operators;
+
+    int get_block_dim(int b) const { return h_diag->get_subspace_dim(b); }
+
+    // The operators of the configuration, in increasing time. taus : 0, their times, beta.
+    std::vector<time_pt> times;
+    std::vector<double> taus;
+    std::vector<op_desc> ops;
+
+    // block -> image of the block by the operator k of the configuration, and its matrix
+    int get_op_block_map(int k, int b) const {
+      auto const &op = ops[k];
+      return (op.dagger ? h_diag->cdag_connection(op.linear_index, b) : h_diag->c_connection(op.linear_index, b));
+    }
+    matrix<h_scalar_t> const &get_op_block_matrix(int k, int b) const {
+      auto const &op = ops[k];
+      return (op.dagger ? h_diag->cdag_matrix(op.linear_index, b) : h_diag->c_matrix(op.linear_index, b));
+    }
+
+    // A product of operators and time evolutions, for all blocks : the image of each block (-1 if none) and its matrix
+    struct block_product_t {
+      std::vector<int> block_table;
+      std::vector<long> offsets;
+      std::vector<h_scalar_t> buffer;
+    };
+    nda::matrix_view<h_scalar_t> get_matrix(block_product_t &p, int b) const {
+      return nda::matrix_view<h_scalar_t>{std::array<long, 2>{get_block_dim(p.block_table[b]), get_block_dim(b)}, p.buffer.data() + p.offsets[b]};
+    }
+    void set_identity(block_product_t &p);
+
+    // q = (operator k) * exp(-dtau H) * p, for the blocks b with needed[b] (all if null)
+    void multiply_left(block_product_t &p, double dtau, int k, block_product_t &q, std::vector<char> const *needed = nullptr);
+    // q = p * exp(-dtau H) * (operator k)
+    void multiply_right(block_product_t &p, double dtau, int k, block_product_t &q);
+
+    // The sums of products of integrate_all_pairs. For a block, all the terms must have the same image.
+    void set_zero(block_product_t &p);
+    // q = op * p
+    void apply_operator(atom_diag::op_block_mat_t const &op, block_product_t &p, block_product_t &q);
+    // p += c * q
+    void add_product(block_product_t &p, h_scalar_t c, block_product_t &q);
+
+    std::vector<block_product_t> right_env; // right_env[i] : from tau = 0 to the operator i (included), i = 0 : identity
+    std::vector<block_product_t> left_env;  // left_env[j] : from the operator j + 1 (included) to beta, j = n : identity
+    block_product_t mid[2];                 // from the operator i + 1 to the operator j (included)
+
+    // Calls evaluate(s, i, j, mid) for the samples s, grouped by the interval i of the earlier time, j : the interval of the later one.
+    // mark(i, g, g_end) marks the blocks needed in mid for the samples order[g..g_end)
+    template <typename Times, typename Mark, typename Evaluate>
+    void sweep(int n_samples, Times const &get_times, Mark const &mark, Evaluate const &evaluate);
+
+    // marks the blocks reached by op from the right environment of the operator i
+    void mark_needed(atom_diag::op_block_mat_t const &op, int i);
+
+    // exp(-(tau_b - tau_j) H) * mid * exp * op_a * exp(-(tau_a - tau_i) H) * right_env[i], for the block b0. In workspace 0 or 1.
+    nda::matrix_view<h_scalar_t> earlier_product(int i, int j, block_product_t &mid, int b0, atom_diag::op_block_mat_t const &op_a, double tau_a,
+                                                 double tau_b);
+
+    // workspace
+    std::vector<h_scalar_t> buffers[3];
+    std::vector<double> exp_factors;
+    nda::matrix_view<h_scalar_t> ws_matrix(int i, long n_rows, long n_cols) {
+      auto &buf = buffers[i];
+      if (long(buf.size()) < n_rows * n_cols) buf.resize(n_rows * n_cols);
+      return nda::matrix_view<h_scalar_t>{std::array<long, 2>{n_rows, n_cols}, buf.data()};
+    }
+    // M <- exp(-dtau H) * M, M of rows in block b
+    void evolve_rows(nda::matrix_view<h_scalar_t> M, int b, double dtau);
+
+    std::vector<std::array<int, 3>> order; // interval of the earlier insertion, interval of the later one, index
+    std::vector<char> needed;
+    std::vector<std::array<int, 3>> earlier; // compute_all_pairs : block after the earlier operator, operator, offset in earlier_buffer
+    std::vector<h_scalar_t> earlier_buffer;
+    // integrate_all_pairs : the sums with the operator e, and with e then l, inserted before the current operator
+    std::vector<block_product_t> sums_1, sums_2;
+    block_product_t op_right_env, half_sum, product, sum_tmp;
+  };
+
+} // namespace triqs_cthyb
@@ -81,7 +81,7 @@ namespace triqs_cthyb {
 
     template <G2_channel Channel> void measure_G2_iw_base<Channel>::accumulate_G2(mc_weight_t s) {
 
-      s *= data.atomic_reweighting;
+      s *= data.atomic_reweighting();
       average_sign += s;
       
       timer_G2.start();
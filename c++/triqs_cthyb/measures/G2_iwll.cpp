@@ -62,7 +62,7 @@ namespace triqs_cthyb {
 
   template <G2_channel Channel> void measure_G2_iwll<Channel>::accumulate(mc_weight_t s) {
 
-    s *= data.atomic_reweighting;
+    s *= data.atomic_reweighting();
     average_sign += s;
 
     double beta = data.config.beta();
@@ -45,7 +45,7 @@ namespace triqs_cthyb {
 
   void measure_G2_tau::accumulate(mc_weight_t sign) {
 
-    sign *= data.atomic_reweighting;
+    sign *= data.atomic_reweighting();
     average_sign += sign;
 
     // loop only over block-combinations that should be measured
@@ -33,7 +33,7 @@ namespace triqs_cthyb {
   }
 
   void measure_G_l::accumulate(mc_weight_t s) {
-    s *= data.atomic_reweighting;
+    s *= data.atomic_reweighting();
     average_sign += s;
 
     double beta = data.config.beta();
@@ -37,7 +37,7 @@ namespace triqs_cthyb {
   }
 
   void measure_G_tau::accumulate(mc_weight_t s) {
-    s *= data.atomic_reweighting;
+    s *= data.atomic_reweighting();
     average_sign += s;
 
     for (auto block_idx : range(G_tau.size())) {
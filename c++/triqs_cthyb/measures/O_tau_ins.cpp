@@ -31,17 +31,17 @@ namespace triqs_cthyb {
 
   measure_O_tau_ins::measure_O_tau_ins(std::optional<gf<imtime, scalar_valued>> &O_tau_opt, qmc_data const &data, int n_tau,
                                        many_body_op_t const &op1, many_body_op_t const &op2, int min_ins, mc_tools::random_generator &rng)
-    : data(data), average_sign(0), op1(op1), op2(op2), min_ins(min_ins), rng(rng) {
+    : data(data), average_sign(0), op1(op1), op2(op2), min_ins(min_ins), rng(rng), ins_trace(data.config.beta(), data.h_diag) {
     O_tau_opt = gf<imtime, scalar_valued>{{data.config.beta(), Boson, n_tau}};
     O_tau.rebind(*O_tau_opt);
     O_tau() = 0.0;
 
-    op1_d = data.imp_trace.attach_aux_operator(op1);
-    op2_d = data.imp_trace.attach_aux_operator(op2);
+    op1_i = ins_trace.attach_operator(op1);
+    op2_i = ins_trace.attach_operator(op2);
   }
 
   void measure_O_tau_ins::accumulate(mc_weight_t s) {
-    s *= data.atomic_reweighting;
+    s *= data.atomic_reweighting();
     average_sign += s;
 
     int pto = 0;
@@ -49,24 +49,15 @@ namespace triqs_cthyb {
     int nsamples = pto * pto;
     if( nsamples < min_ins ) nsamples = min_ins;
 
-    mc_weight_t atomic_weight, atomic_reweighting;
-    auto [bare_atomic_weight, bare_atomic_reweighting] = data.imp_trace.compute();
-    const auto prefactor = s / bare_atomic_weight / bare_atomic_reweighting / double(nsamples);
+    // the environments of the configuration, then the traces of all samples
+    auto bare_trace      = ins_trace.set_configuration(data.config);
+    const auto prefactor = s / bare_trace / double(nsamples);
 
-    for (int i : range(nsamples)) {
-      auto tau1 = data.tau_seg.get_random_pt(rng);
-      auto tau2 = data.tau_seg.get_random_pt(rng);
-      double dtau = double(tau2 - tau1);
+    insertions.resize(nsamples);
+    for (auto &x : insertions) x = {data.tau_seg.get_random_pt(rng), data.tau_seg.get_random_pt(rng), op1_i, op2_i};
+    ins_trace.compute(insertions);
 
-      try {
-        data.imp_trace.try_insert(tau1, op1_d);
-        data.imp_trace.try_insert(tau2, op2_d);
-        std::tie(atomic_weight, atomic_reweighting) = data.imp_trace.compute();
-      } catch (rbt_insert_error const &) { atomic_weight = 0.; }
-
-      data.imp_trace.cancel_insert();
-      O_tau[closest_mesh_pt(dtau)] += prefactor * atomic_weight * atomic_reweighting;
-    }
+    for (auto const &x : insertions) O_tau[closest_mesh_pt(double(x.tau2 - x.tau1))] += prefactor * x.trace;
   }
 
   void measure_O_tau_ins::collect_results(mpi::communicator const &c) {
@@ -85,4 +76,54 @@ namespace triqs_cthyb {
     O_tau[0]    = average;
     O_tau[last] = average;
   }
+
+  // -------------------------------------------------------------------------
+
+  measure_O_tau_matrix_ins::measure_O_tau_matrix_ins(std::optional<gf<imtime, matrix_valued>> &O_tau_matrix_opt, qmc_data const &data, int n_tau,
+                                                     std::vector<many_body_op_t> const &ops, int min_ins, mc_tools::random_generator &rng)
+    : data(data), average_sign(0), n_ops(ops.size()), min_ins(min_ins), rng(rng), ins_trace(data.config.beta(), data.h_diag) {
+    O_tau_matrix_opt = gf<imtime, matrix_valued>{{data.config.beta(), Boson, n_tau}, {n_ops, n_ops}};
+    O_tau_matrix.rebind(*O_tau_matrix_opt);
+    O_tau_matrix() = 0.0;
+
+    for (auto const &op : ops) ins_trace.attach_operator(op);
+  }
+
+  void measure_O_tau_matrix_ins::accumulate(mc_weight_t s) {
+    s *= data.atomic_reweighting();
+    average_sign += s;
+
+    int pto = 0;
+    for (const auto &det : data.dets) pto += det.size();
+    int nsamples = pto * pto;
+    if( nsamples < min_ins ) nsamples = min_ins;
+
+    auto bare_trace      = ins_trace.set_configuration(data.config);
+    const auto prefactor = s / bare_trace / double(nsamples);
+
+    samples.resize(nsamples);
+    for (auto &x : samples) x = {data.tau_seg.get_random_pt(rng), data.tau_seg.get_random_pt(rng)};
+    ins_trace.compute_all_pairs(samples, traces);
+
+    for (int k = 0; k < nsamples; ++k) {
+      auto O         = O_tau_matrix[closest_mesh_pt(double(samples[k].second - samples[k].first))];
+      auto const *tr = traces.data() + long(k) * n_ops * n_ops;
+      for (int a = 0; a < n_ops; ++a)
+        for (int b = 0; b < n_ops; ++b) O(a, b) += prefactor * tr[a * n_ops + b];
+    }
+  }
+
+  void measure_O_tau_matrix_ins::collect_results(mpi::communicator const &c) {
+    O_tau_matrix = mpi::all_reduce(O_tau_matrix, c);
+    average_sign = mpi::all_reduce(average_sign, c);
+
+    O_tau_matrix *= double(O_tau_matrix.mesh().size() - 1) / real(average_sign);
+
+    // as for O_tau, average the half-sized edge bins
+    int last                 = O_tau_matrix.mesh().size() - 1;
+    matrix<dcomplex> average = O_tau_matrix[0] + O_tau_matrix[last];
+
+    O_tau_matrix[0]    = average;
+    O_tau_matrix[last] = average;
+  }
 } // namespace triqs_cthyb
@@ -25,6 +25,7 @@
 #include <triqs/mesh.hpp>
 
 #include "../qmc_data.hpp"
+#include "../insertion_trace.hpp"
 
 namespace triqs_cthyb {
 
@@ -44,10 +45,32 @@ namespace triqs_cthyb {
     mc_weight_t average_sign;
     gf<imtime, scalar_valued>::view_type O_tau;
     many_body_op_t op1, op2;
-    op_desc op1_d, op2_d;
     int min_ins;
     mc_tools::random_generator &rng;
-    
+    insertion_trace ins_trace;                           // the traces with op1, op2 inserted, for all the samples at once
+    int op1_i, op2_i;                                    // the indices of op1, op2 in ins_trace
+    std::vector<insertion_trace::insertion_t> insertions; // the samples
+  };
+
+  // Measure the imaginary time response functions of all pairs of a list of operators, from the same samples
+  class measure_O_tau_matrix_ins {
+
+    public:
+    measure_O_tau_matrix_ins(std::optional<gf<imtime, matrix_valued>> &O_tau_matrix_opt, qmc_data const &data, int n_tau,
+                             std::vector<many_body_op_t> const &ops, int min_ins, mc_tools::random_generator &rng);
+    void accumulate(mc_weight_t s);
+    void collect_results(mpi::communicator const &c);
+
+    private:
+    qmc_data const &data;
+    mc_weight_t average_sign;
+    gf<imtime, matrix_valued>::view_type O_tau_matrix;
+    int n_ops;
+    int min_ins;
+    mc_tools::random_generator &rng;
+    insertion_trace ins_trace;                         // the traces with all pairs of operators inserted, for all the samples at once
+    std::vector<std::pair<time_pt, time_pt>> samples; // the times of the two operators
+    std::vector<h_scalar_t> traces;
   };
 
 } // namespace triqs_cthyb
@@ -38,8 +38,8 @@ namespace triqs_cthyb {
 
     void accumulate(mc_weight_t s) {
 
-      sign += s * data.atomic_reweighting;
-      z += std::abs(data.atomic_reweighting);
+      sign += s * data.atomic_reweighting();
+      z += std::abs(data.atomic_reweighting());
     }
     // ---------------------------------------------
 
@@ -0,0 +1,54 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#include "./chi_static.hpp"
+
+namespace triqs_cthyb {
+
+  measure_chi_static::measure_chi_static(std::optional<matrix<dcomplex>> &chi_static_opt, qmc_data const &data,
+                                         std::vector<many_body_op_t> const &ops)
+    : data(data),
+      average_sign(0),
+      chi_static(chi_static_opt.emplace(ops.size(), ops.size())),
+      n_ops(ops.size()),
+      ins_trace(data.config.beta(), data.h_diag) {
+    chi_static() = 0;
+    for (auto const &op : ops) ins_trace.attach_operator(op);
+  }
+
+  void measure_chi_static::accumulate(mc_weight_t s) {
+    s *= data.atomic_reweighting();
+    average_sign += s;
+
+    // int dtau <O_a(tau) O_b(0)> = 1/beta int dtau1 dtau2 <T O_a(tau1) O_b(tau2)>
+    auto bare_trace = ins_trace.set_configuration(data.config);
+    ins_trace.integrate_all_pairs(integrals);
+    const auto prefactor = s / bare_trace / data.config.beta();
+    for (int a = 0; a < n_ops; ++a)
+      for (int b = 0; b < n_ops; ++b) chi_static(a, b) += prefactor * integrals[a * n_ops + b];
+  }
+
+  void measure_chi_static::collect_results(mpi::communicator const &c) {
+    chi_static   = mpi::all_reduce(chi_static, c);
+    average_sign = mpi::all_reduce(average_sign, c);
+    chi_static /= real(average_sign);
+  }
+
+} // namespace triqs_cthyb
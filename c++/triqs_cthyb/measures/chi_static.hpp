@@ -0,0 +1,45 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include "../qmc_data.hpp"
+#include "../insertion_trace.hpp"
+
+namespace triqs_cthyb {
+
+  // Measure the static susceptibilities chi_ab = int_0^beta dtau <O_a(tau) O_b(0)> of operators commuting with H_loc,
+  // integrated exactly over the times of the operators for each configuration
+  class measure_chi_static {
+
+    public:
+    measure_chi_static(std::optional<matrix<dcomplex>> &chi_static_opt, qmc_data const &data, std::vector<many_body_op_t> const &ops);
+    void accumulate(mc_weight_t s);
+    void collect_results(mpi::communicator const &c);
+
+    private:
+    qmc_data const &data;
+    mc_weight_t average_sign;
+    matrix<dcomplex> &chi_static;
+    int n_ops;
+    insertion_trace ins_trace;
+    std::vector<h_scalar_t> integrals; // the integrals of the traces with O_a and O_b inserted, for the current configuration
+  };
+
+} // namespace triqs_cthyb
@@ -37,11 +37,8 @@ namespace triqs_cthyb {
   void measure_density_matrix::accumulate(mc_weight_t s) {
     // we assume here that we are in "Norm" mode, i.e. qmc weight is norm, not trace
 
-    // We need to recompute since the density_matrix in the trace is changed at each computatation,
-    // in particular at the last failed attempt.
-    // So we need to compute it, without any Yee threshold.
-    data.imp_trace.compute();
-    z += s * data.atomic_reweighting;
+    // The density matrix of the accepted configuration, kept by the trace : the failed attempts did not change it
+    z += s * data.atomic_reweighting();
     s /= data.atomic_weight; // accumulate matrix / norm since weight is norm * det
 
     // Careful: there is no reweighting factor here!
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+
+#include "./adaptive_move_set.hpp"
+#include <mpi/vector.hpp>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace triqs_cthyb {
+
+  proposal_tuner::proposal_tuner(std::vector<std::string> block_names, std::vector<double> priors)
+     : block_names(std::move(block_names)), priors(priors), probs(priors), n_accepted(priors.size(), 0), time(priors.size(), 0) {}
+
+  void proposal_tuner::record(int block, bool accepted, double t) {
+    n_accepted[block] += accepted;
+    time[block] += t;
+    if (++n_records == update_period) update();
+  }
+
+  void proposal_tuner::update() {
+    std::vector<double> efficiency(priors.size(), 0);
+    for (int b = 0; b < priors.size(); ++b)
+      if (time[b] > 0) efficiency[b] = n_accepted[b] / time[b];
+    double e_max = *std::max_element(efficiency.begin(), efficiency.end());
+    for (int b = 0; b < priors.size(); ++b) probs[b] = priors[b] * std::max(min_ratio, (e_max > 0 ? std::sqrt(efficiency[b] / e_max) : 1.0));
+    n_records = 0;
+    ++version;
+  }
+
+  void proposal_tuner::freeze(mpi::communicator const &c) {
+    n_accepted = mpi::all_reduce(n_accepted, c);
+    time       = mpi::all_reduce(time, c);
+    update();
+    frozen = true;
+  }
+
+  std::map<std::string, double> proposal_tuner::get_probs() const {
+    double norm = std::accumulate(priors.begin(), priors.end(), 0.0) / std::accumulate(probs.begin(), probs.end(), 0.0);
+    std::map<std::string, double> res;
+    for (int b = 0; b < priors.size(); ++b) res[block_names[b]] = probs[b] * norm;
+    return res;
+  }
+
+  //----------------
+
+  mc_weight_t adaptive_move_set::attempt() {
+    if (probs_version != tuner->get_version()) {
+      cumulated_probs.resize(moves.size());
+      double s = 0;
+      for (int i = 0; i < moves.size(); ++i) cumulated_probs[i] = (s += tuner->get_prob(moves[i].block));
+      probs_version = tuner->get_version();
+    }
+    double r = rng() * cumulated_probs.back();
+    current  = std::min<int>(std::upper_bound(cumulated_probs.begin(), cumulated_probs.end(), r) - cumulated_probs.begin(), moves.size() - 1);
+    if (!tuner->is_frozen()) start = std::chrono::steady_clock::now();
+    return moves[current].attempt();
+  }
+
+  mc_weight_t adaptive_move_set::accept() {
+    auto res = moves[current].accept();
+    record(true);
+    return res;
+  }
+
+  void adaptive_move_set::reject() {
+    moves[current].reject();
+    record(false);
+  }
+
+  void adaptive_move_set::record(bool accepted) {
+    if (tuner->is_frozen()) return;
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    tuner->record(moves[current].block, accepted, t.count());
+  }
+
+} // namespace triqs_cthyb
@@ -0,0 +1,115 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <triqs/mc_tools.hpp>
+#include <mpi/mpi.hpp>
+#include "../qmc_data.hpp"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  /**
+   * The probabilities of proposing each block in the insertions and removals of two operators, tuned during the warmup.
+   *
+   * The insertions and the removals must propose a block with the same probability for their proposal ratios to hold :
+   * both sets of moves share one tuner, which counts their accepted moves and time together, per block.
+   * The probability of a block is its prior (proposal_prob) times sqrt(e / e_max), with e the number of accepted moves
+   * per second of the block, and at least min_ratio times the prior : the moves of all blocks are needed for ergodicity.
+   * The probabilities are updated every update_period moves, and frozen before the accumulation.
+   */
+  class proposal_tuner {
+
+    public:
+    proposal_tuner(std::vector<std::string> block_names, std::vector<double> priors);
+
+    double get_prob(int block) const { return probs[block]; }
+
+    // Changes each time the probabilities change
+    int get_version() const { return version; }
+
+    bool is_frozen() const { return frozen; }
+
+    // Record a move of the block, which took time seconds
+    void record(int block, bool accepted, double time);
+
+    // Set the probabilities from the statistics of all the nodes, and stop tuning
+    void freeze(mpi::communicator const &c);
+
+    // block name -> probability, normalized as the priors : to be used as proposal_prob
+    std::map<std::string, double> get_probs() const;
+
+    private:
+    static constexpr long update_period = 1000;
+    static constexpr double min_ratio   = 0.1;
+
+    std::vector<std::string> block_names;
+    std::vector<double> priors, probs;
+    std::vector<double> n_accepted, time; // per block
+    long n_records = 0;                   // since the last update
+    int version    = 0;
+    bool frozen    = false;
+
+    void update();
+  };
+
+  /**
+   * A set of moves, one of which is attempted at random as in mc_tools::move_set.
+   * The probability of a move is the probability of its block given by a proposal_tuner.
+   * While the tuner is not frozen, the moves are timed and recorded in it.
+   */
+  class adaptive_move_set {
+
+    struct entry_t {
+      std::function<mc_weight_t()> attempt, accept;
+      std::function<void()> reject;
+      int block;
+    };
+
+    std::vector<entry_t> moves;
+    std::shared_ptr<proposal_tuner> tuner;
+    mc_tools::random_generator &rng;
+    std::vector<double> cumulated_probs; // of the moves, for the version probs_version of the tuner
+    int probs_version = -1;
+    int current       = 0;
+    std::chrono::steady_clock::time_point start;
+
+    void record(bool accepted);
+
+    public:
+    adaptive_move_set(mc_tools::random_generator &rng, std::shared_ptr<proposal_tuner> tuner) : tuner(std::move(tuner)), rng(rng) {}
+
+    // Add a move of the block. The set can be copied : the move is shared by the copies.
+    template <typename MoveType> void add(MoveType &&m, int block) {
+      auto p = std::make_shared<std::decay_t<MoveType>>(std::forward<MoveType>(m));
+      moves.push_back({[p]() { return p->attempt(); }, [p]() { return p->accept(); }, [p]() { p->reject(); }, block});
+    }
+
+    mc_weight_t attempt();
+    mc_weight_t accept();
+    void reject();
+  };
+} // namespace triqs_cthyb
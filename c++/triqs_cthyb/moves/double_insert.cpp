@@ -31,7 +31,7 @@ namespace triqs_cthyb {
 
   move_insert_c_c_cdag_cdag::move_insert_c_c_cdag_cdag(int block_index1, int block_index2, int block_size1, int block_size2,
                                                        std::string const &block_name1, std::string const &block_name2, qmc_data &data,
-                                                       mc_tools::random_generator &rng, histo_map_t *histos)
+                                                       mc_tools::random_generator &rng, histo_map_t *histos, double window_width)
      : data(data),
        config(data.config),
        rng(rng),
@@ -42,7 +42,9 @@ namespace triqs_cthyb {
        histo_proposed1(add_histo("double_insert_length_proposed_" + block_name1, histos)),
        histo_proposed2(add_histo("double_insert_length_proposed_" + block_name2, histos)),
        histo_accepted1(add_histo("double_insert_length_accepted_" + block_name1, histos)),
-       histo_accepted2(add_histo("double_insert_length_accepted_" + block_name2, histos)) {}
+       histo_accepted2(add_histo("double_insert_length_accepted_" + block_name2, histos)) {
+    if (window_width > 0) window.emplace(data.tau_seg, window_width);
+  }
 
   mc_weight_t move_insert_c_c_cdag_cdag::attempt() {
 
@@ -61,9 +63,15 @@ namespace triqs_cthyb {
 
     // Choice of times for insertion. Find the time as double and them put them on the grid.
     tau1 = data.tau_seg.get_random_pt(rng);
-    tau2 = data.tau_seg.get_random_pt(rng);
-    tau3 = data.tau_seg.get_random_pt(rng);
-    tau4 = data.tau_seg.get_random_pt(rng);
+    if (window) {
+      tau2 = window->get_random_pt(data.tau_seg, rng, tau1);
+      tau3 = data.tau_seg.get_random_pt(rng);
+      tau4 = window->get_random_pt(data.tau_seg, rng, tau3);
+    } else {
+      tau2 = data.tau_seg.get_random_pt(rng);
+      tau3 = data.tau_seg.get_random_pt(rng);
+      tau4 = data.tau_seg.get_random_pt(rng);
+    }
     if ((tau1 == tau3) or (tau2 == tau4)) return 0; // trying to insert/remove two operators at exactly the same time
 
 #ifdef EXT_DEBUG
@@ -98,26 +106,23 @@ namespace triqs_cthyb {
     }
 
     // Computation of det ratio
-    auto &det1    = data.dets[block_index1];
-    auto &det2    = data.dets[block_index2];
-    int det1_size = det1.size();
-    int det2_size = det2.size();
+    auto &det1 = data.dets[block_index1];
+    auto &det2 = data.dets[block_index2];
     det_scalar_t det_ratio;
 
     // Find the position for insertion in the determinant
     // NB : the determinant stores the C in decreasing time order.
-    int num_c_dag1, num_c1, num_c_dag2, num_c2;
-    for (num_c_dag1 = 0; num_c_dag1 < det1_size; ++num_c_dag1) {
-      if (det1.get_x(num_c_dag1).first < tau1) break;
-    }
-    for (num_c1 = 0; num_c1 < det1_size; ++num_c1) {
-      if (det1.get_y(num_c1).first < tau2) break;
-    }
-    for (num_c_dag2 = 0; num_c_dag2 < det2_size; ++num_c_dag2) {
-      if (det2.get_x(num_c_dag2).first < tau3) break;
-    }
-    for (num_c2 = 0; num_c2 < det2_size; ++num_c2) {
-      if (det2.get_y(num_c2).first < tau4) break;
+    int num_c_dag1 = det_position(det1, tau1, true);
+    int num_c1     = det_position(det1, tau2, false);
+    int num_c_dag2 = det_position(det2, tau3, true);
+    int num_c2     = det_position(det2, tau4, false);
+
+    // The numbers of C in the windows of the C^dagger after the insertion
+    int n_window1 = 0, n_window2 = 0;
+    if (window) {
+      bool same_block = (block_index1 == block_index2);
+      n_window1       = window->find_c(det1, tau1).first + 1 + (same_block && window->contains(tau1, tau4));
+      n_window2       = window->find_c(det2, tau3).first + 1 + (same_block && window->contains(tau3, tau2));
     }
 
     // Insert in the det. Returns the ratio of dets (Cf det_manip doc).
@@ -143,7 +148,12 @@ namespace triqs_cthyb {
 
     // proposition probability
     mc_weight_t t_ratio;
-    if (block_index1 == block_index2) {
+    if (window) {
+      // Local move : the C are drawn in the windows of the C^dagger, the removal picks them among the n_window in these windows
+      double n1 = det1.size() + (block_index1 == block_index2 ? 2 : 1), n2 = det2.size() + (block_index1 == block_index2 ? 2 : 1);
+      t_ratio   = (block_size1 * block_size1 * config.beta() * double(window->width) / (n1 * n_window1))
+         * (block_size2 * block_size2 * config.beta() * double(window->width) / (n2 * n_window2));
+    } else if (block_index1 == block_index2) {
       // (ways to insert 4 operators in det1)/((ways to remove 4 operators from det that is larger by two))
       // Here, we use the fact that the two cdag/c proposed to be removed in the det can be at the same
       // positions in the det, and thus remove prob is NOT (detsize+2)*(detsize+1)
@@ -206,10 +216,10 @@ namespace triqs_cthyb {
       data.dets[block_index1].complete_operation();
       data.dets[block_index2].complete_operation();
     }
-    data.update_sign();
+    data.update_sign({{tau1, block_index1, op1.dagger}, {tau2, block_index1, op2.dagger}, {tau3, block_index2, op3.dagger},
+                      {tau4, block_index2, op4.dagger}});
 
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
 
     if (histo_accepted1) {
       *histo_accepted1 << dtau1;
@@ -31,7 +31,7 @@ namespace triqs_cthyb {
 
   move_remove_c_c_cdag_cdag::move_remove_c_c_cdag_cdag(int block_index1, int block_index2, int block_size1, int block_size2,
                                                        std::string const &block_name1, std::string const &block_name2, qmc_data &data,
-                                                       mc_tools::random_generator &rng, histo_map_t *histos)
+                                                       mc_tools::random_generator &rng, histo_map_t *histos, double window_width)
      : data(data),
        config(data.config),
        rng(rng),
@@ -42,7 +42,9 @@ namespace triqs_cthyb {
        histo_proposed1(add_histo("double_remove_length_proposed_" + block_name1, histos)),
        histo_proposed2(add_histo("double_remove_length_proposed_" + block_name2, histos)),
        histo_accepted1(add_histo("double_remove_length_accepted_" + block_name1, histos)),
-       histo_accepted2(add_histo("double_remove_length_accepted_" + block_name2, histos)) {}
+       histo_accepted2(add_histo("double_remove_length_accepted_" + block_name2, histos)) {
+    if (window_width > 0) window.emplace(data.tau_seg, window_width);
+  }
 
   mc_weight_t move_remove_c_c_cdag_cdag::attempt() {
 
@@ -65,8 +67,21 @@ namespace triqs_cthyb {
     } else {
       if ((det1_size == 0) || (det2_size == 0)) return 0; // one of two dets is empty
     }
-    int num_c_dag1 = rng(det1_size), num_c1 = rng(det1_size);
-    int num_c_dag2 = rng(det2_size), num_c2 = rng(det2_size);
+    int num_c_dag1, num_c1, num_c_dag2, num_c2, n_window1 = 0, n_window2 = 0;
+    if (window) { // the C are picked among those in the windows of the C^dagger
+      int first;
+      num_c_dag1                 = rng(det1_size);
+      std::tie(n_window1, first) = window->find_c(det1, det1.get_x(num_c_dag1).first);
+      if (n_window1 == 0) return 0;
+      num_c1                     = (first + rng(n_window1)) % det1_size;
+      num_c_dag2                 = rng(det2_size);
+      std::tie(n_window2, first) = window->find_c(det2, det2.get_x(num_c_dag2).first);
+      if (n_window2 == 0) return 0;
+      num_c2 = (first + rng(n_window2)) % det2_size;
+    } else {
+      num_c_dag1 = rng(det1_size), num_c1 = rng(det1_size);
+      num_c_dag2 = rng(det2_size), num_c2 = rng(det2_size);
+    }
     if ((block_index1 == block_index2) && ((num_c_dag1 == num_c_dag2) || (num_c1 == num_c2))) return 0; // picked the same operator twice
 
 #ifdef EXT_DEBUG
@@ -102,7 +117,10 @@ namespace triqs_cthyb {
     // proposition probability
     mc_weight_t t_ratio;
     // Note: Must use the size of the det before the try_delete!
-    if (block_index1 == block_index2) {
+    if (window) {
+      t_ratio = (block_size1 * block_size1 * config.beta() * double(window->width) / (double(det1_size) * n_window1))
+         * (block_size2 * block_size2 * config.beta() * double(window->width) / (double(det2_size) * n_window2));
+    } else if (block_index1 == block_index2) {
       // Here, we use the fact that the two cdag/c proposed to be removed in the det can be at the same
       // positions in the det, and thus remove prob is NOT (detsize+2)*(detsize+1)
       t_ratio = std::pow(block_size1 * config.beta() / double(det1_size), 4);
@@ -162,10 +180,9 @@ namespace triqs_cthyb {
       data.dets[block_index1].complete_operation();
       data.dets[block_index2].complete_operation();
     }
-    data.update_sign();
+    data.update_sign({{tau1, block_index1, false}, {tau2, block_index1, true}, {tau3, block_index2, false}, {tau4, block_index2, true}});
 
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
 
     if (histo_accepted1) {
       *histo_accepted1 << dtau1;
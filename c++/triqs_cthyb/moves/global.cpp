@@ -173,10 +173,9 @@ namespace triqs_cthyb {
     for (auto block_index : affected_blocks) data.dets[block_index].complete_operation();
 
     data.update_sign();
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
 
     data.imp_trace.confirm_replace();
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
 
 #ifdef EXT_DEBUG
     std::cerr << "* Move move_global '" << name << "' accepted" << std::endl;
@@ -30,14 +30,16 @@ namespace triqs_cthyb {
   }
 
   move_insert_c_cdag::move_insert_c_cdag(int block_index, int block_size, std::string const &block_name, qmc_data &data,
-                                         mc_tools::random_generator &rng, histo_map_t *histos)
+                                         mc_tools::random_generator &rng, histo_map_t *histos, double window_width)
      : data(data),
        config(data.config),
        rng(rng),
        block_index(block_index),
        block_size(block_size),
        histo_proposed(add_histo("insert_length_proposed_" + block_name, histos)),
-       histo_accepted(add_histo("insert_length_accepted_" + block_name, histos)) {}
+       histo_accepted(add_histo("insert_length_accepted_" + block_name, histos)) {
+    if (window_width > 0) window.emplace(data.tau_seg, window_width);
+  }
 
   mc_weight_t move_insert_c_cdag::attempt() {
 
@@ -54,7 +56,7 @@ namespace triqs_cthyb {
 
     // Choice of times for insertion. Find the time as double and them put them on the grid.
     tau1 = data.tau_seg.get_random_pt(rng);
-    tau2 = data.tau_seg.get_random_pt(rng);
+    tau2 = (window ? window->get_random_pt(data.tau_seg, rng, tau1) : data.tau_seg.get_random_pt(rng));
 
 #ifdef EXT_DEBUG
     std::cerr << "* Proposing to insert:" << std::endl;
@@ -80,24 +82,23 @@ namespace triqs_cthyb {
     }
 
     // Computation of det ratio
-    auto &det    = data.dets[block_index];
-    int det_size = det.size();
+    auto &det = data.dets[block_index];
 
     // Find the position for insertion in the determinant
     // NB : the determinant stores the C in decreasing time order.
-    int num_c_dag, num_c;
-    for (num_c_dag = 0; num_c_dag < det_size; ++num_c_dag) {
-      if (det.get_x(num_c_dag).first < tau1) break;
-    }
-    for (num_c = 0; num_c < det_size; ++num_c) {
-      if (det.get_y(num_c).first < tau2) break;
-    }
+    int num_c_dag = det_position(det, tau1, true);
+    int num_c     = det_position(det, tau2, false);
+
+    // The number of C in the window of the C^dagger after the insertion
+    int n_window = (window ? window->find_c(det, tau1).first + 1 : 0);
 
     // Insert in the det. Returns the ratio of dets (Cf det_manip doc).
     auto det_ratio = det.try_insert(num_c_dag, num_c, {tau1, op1.inner_index}, {tau2, op2.inner_index});
 
     // proposition probability
-    mc_weight_t t_ratio = std::pow(block_size * config.beta() / double(det.size() + 1), 2);
+    // Local move : tau2 is drawn in the window of tau1, the removal picks the C among the n_window in the window of the C^dagger
+    mc_weight_t t_ratio = (window ? block_size * block_size * config.beta() * double(window->width) / (double(det.size() + 1) * n_window)
+                                  : std::pow(block_size * config.beta() / double(det.size() + 1), 2));
 
     // For quick abandon
     double random_number = rng.preview();
@@ -152,9 +153,8 @@ namespace triqs_cthyb {
 
     // insert in the determinant
     data.dets[block_index].complete_operation();
-    data.update_sign();
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
+    data.update_sign({{tau1, block_index, op1.dagger}, {tau2, block_index, op2.dagger}});
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
     if (histo_accepted) *histo_accepted << dtau;
 
 #ifdef EXT_DEBUG
@@ -30,14 +30,16 @@ namespace triqs_cthyb {
   }
 
   move_remove_c_cdag::move_remove_c_cdag(int block_index, int block_size, std::string const &block_name, qmc_data &data, mc_tools::random_generator &rng,
-                     histo_map_t *histos)
+                     histo_map_t *histos, double window_width)
      : data(data),
        config(data.config),
        rng(rng),
        block_index(block_index),
        block_size(block_size),
        histo_proposed(add_histo("remove_length_proposed_" + block_name, histos)),
-       histo_accepted(add_histo("remove_length_accepted_" + block_name, histos)) {}
+       histo_accepted(add_histo("remove_length_accepted_" + block_name, histos)) {
+    if (window_width > 0) window.emplace(data.tau_seg, window_width);
+  }
 
   mc_weight_t move_remove_c_cdag::attempt() {
 
@@ -53,7 +55,14 @@ namespace triqs_cthyb {
     // Remove the operators from the traces
     int det_size = det.size();
     if (det_size == 0) return 0; // nothing to remove
-    int num_c_dag = rng(det_size), num_c = rng(det_size);
+    int num_c_dag = rng(det_size), num_c, n_window = 0;
+    if (window) { // the C is picked among those in the window of the C^dagger
+      int first;
+      std::tie(n_window, first) = window->find_c(det, det.get_x(num_c_dag).first);
+      if (n_window == 0) return 0;
+      num_c = (first + rng(n_window)) % det_size;
+    } else
+      num_c = rng(det_size);
 
 #ifdef EXT_DEBUG
     std::cerr << "* Proposing to remove: ";
@@ -72,7 +81,9 @@ namespace triqs_cthyb {
     auto det_ratio = det.try_remove(num_c_dag, num_c);
 
     // proposition probability
-    auto t_ratio = std::pow(block_size * config.beta() / double(det_size), 2); // Size of the det before the try_delete!
+    // Size of the det before the try_delete!
+    mc_weight_t t_ratio = (window ? block_size * block_size * config.beta() * double(window->width) / (double(det_size) * n_window)
+                                  : std::pow(block_size * config.beta() / double(det_size), 2));
 
     // For quick abandon
     double random_number = rng.preview();
@@ -128,9 +139,8 @@ namespace triqs_cthyb {
 
     // remove from the determinants
     data.dets[block_index].complete_operation();
-    data.update_sign();
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
+    data.update_sign({{tau1, block_index, false}, {tau2, block_index, true}});
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
     if (histo_accepted) *histo_accepted << dtau;
 
 #ifdef EXT_DEBUG
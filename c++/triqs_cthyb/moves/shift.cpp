@@ -57,14 +57,10 @@ namespace triqs_cthyb {
     }
     const int op_pos_in_config = rng(config_size);
 
-    // --- Find operator (and its characteristics) from the configuration
-    auto itconfig = config.begin();
-    for (int i = 0; i < op_pos_in_config; ++i, ++itconfig)
-      ; // Get to right position in config
-    tau_old        = (*itconfig).first;
-    op_old         = (*itconfig).second;
-    block_index    = op_old.block_index;
-    auto is_dagger = op_old.dagger;
+    // --- Find operator (and its characteristics) from the configuration, by its rank in the tree of the trace
+    std::tie(tau_old, op_old) = data.imp_trace.get_operator(op_pos_in_config);
+    block_index               = op_old.block_index;
+    auto is_dagger            = op_old.dagger;
 
 #ifdef EXT_DEBUG
     std::cerr << "(block " << block_index << ")" << std::endl;
@@ -94,12 +90,8 @@ namespace triqs_cthyb {
       // Find the c and c_dag operators at the right of op_old (at smaller times)
       // They could be the last entries (earliest times)
 
-      for (ic_dag = 0; ic_dag < det_size; ++ic_dag) { // c_dag
-        if (det.get_x(ic_dag).first < tau_old) break;
-      }
-      for (ic = 0; ic < det_size; ++ic) { // c
-        if (det.get_y(ic).first < tau_old) break;
-      }
+      ic_dag = det_position(det, tau_old, true); // c_dag
+      ic     = det_position(det, tau_old, false); // c
 
       op_pos_in_det = (is_dagger ? ic_dag : ic); // This finds the operator on the right
       --op_pos_in_det;                           // Rewind by one to find the operator
@@ -216,10 +208,9 @@ namespace triqs_cthyb {
 
     // Update the determinant
     data.dets[block_index].complete_operation();
-    data.update_sign();
+    data.update_sign({{tau_old, block_index, op_old.dagger}, {tau_new, block_index, op_new.dagger}});
 
-    data.atomic_weight      = new_atomic_weight;
-    data.atomic_reweighting = new_atomic_reweighting;
+    data.set_atomic_weight(new_atomic_weight, new_atomic_reweighting);
 
     if (histo_accepted) *histo_accepted << dtau;
 
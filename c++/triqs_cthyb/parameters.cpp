@@ -91,6 +91,8 @@ namespace triqs_cthyb {
 
     h5_write(grp, "length_cycle", sp.length_cycle);
     h5_write(grp, "n_warmup_cycles", sp.n_warmup_cycles);
+    h5_write(grp, "stop_warmup_when_stationary", sp.stop_warmup_when_stationary);
+    h5_write(grp, "tune_length_cycle", sp.tune_length_cycle);
     h5_write(grp, "random_seed", sp.random_seed);
     h5_write(grp, "random_name", sp.random_name);
     h5_write(grp, "max_time", sp.max_time);
@@ -98,12 +100,15 @@ namespace triqs_cthyb {
 
     h5_write(grp, "move_shift", sp.move_shift);
     h5_write(grp, "move_double", sp.move_double);
+    h5_write(grp, "local_move_window", sp.local_move_window);
     h5_write(grp, "use_trace_estimator", sp.use_trace_estimator);
 
     h5_write(grp, "measure_G_tau", sp.measure_G_tau);
     h5_write(grp, "measure_G_l", sp.measure_G_l);
     h5_write(grp, "measure_O_tau", sp.measure_O_tau);
     h5_write(grp, "measure_O_tau_min_ins", sp.measure_O_tau_min_ins);
+    h5_write(grp, "measure_O_tau_matrix", sp.measure_O_tau_matrix);
+    h5_write(grp, "measure_chi_static", sp.measure_chi_static);
     h5_write(grp, "measure_G2_tau", sp.measure_G2_tau);
     h5_write(grp, "measure_G2_iw", sp.measure_G2_iw);
     h5_write(grp, "measure_G2_iw_nfft", sp.measure_G2_iw_nfft);
@@ -128,7 +133,12 @@ namespace triqs_cthyb {
     h5_write(grp, "measure_density_matrix", sp.measure_density_matrix);
     h5_write(grp, "use_norm_as_weight", sp.use_norm_as_weight);
     h5_write(grp, "performance_analysis", sp.performance_analysis);
+    h5_write(grp, "n_trace_threads", sp.n_trace_threads);
+    h5_write(grp, "use_state_propagation", sp.use_state_propagation);
+    h5_write(grp, "state_propagation_cutoff", sp.state_propagation_cutoff);
+    h5_write(grp, "use_float_estimates", sp.use_float_estimates);
     h5_write(grp, "proposal_prob", sp.proposal_prob);
+    h5_write(grp, "tune_proposal_prob", sp.tune_proposal_prob);
 
     //h5_write(grp, "move_global", sp.move_global);
     if( sp.move_global.size() != 0 )
@@ -158,6 +168,8 @@ namespace triqs_cthyb {
 
     h5_read(grp, "length_cycle", sp.length_cycle);
     h5_read(grp, "n_warmup_cycles", sp.n_warmup_cycles);
+    h5_try_read(grp, "stop_warmup_when_stationary", sp.stop_warmup_when_stationary);
+    h5_try_read(grp, "tune_length_cycle", sp.tune_length_cycle);
     h5_read(grp, "random_seed", sp.random_seed);
     h5_read(grp, "random_name", sp.random_name);
     h5_read(grp, "max_time", sp.max_time);
@@ -165,12 +177,15 @@ namespace triqs_cthyb {
 
     h5_read(grp, "move_shift", sp.move_shift);
     h5_read(grp, "move_double", sp.move_double);
+    h5_try_read(grp, "local_move_window", sp.local_move_window);
     h5_read(grp, "use_trace_estimator", sp.use_trace_estimator);
 
     h5_read(grp, "measure_G_tau", sp.measure_G_tau);
     h5_read(grp, "measure_G_l", sp.measure_G_l);
     if( grp.has_key("measure_O_tau") ) h5_read(grp, "measure_O_tau", sp.measure_O_tau);
     h5_read(grp, "measure_O_tau_min_ins", sp.measure_O_tau_min_ins);
+    if( grp.has_key("measure_O_tau_matrix") ) h5_read(grp, "measure_O_tau_matrix", sp.measure_O_tau_matrix);
+    if( grp.has_key("measure_chi_static") ) h5_read(grp, "measure_chi_static", sp.measure_chi_static);
     h5_read(grp, "measure_G2_tau", sp.measure_G2_tau);
     h5_read(grp, "measure_G2_iw", sp.measure_G2_iw);
     h5_read(grp, "measure_G2_iw_nfft", sp.measure_G2_iw_nfft);
@@ -195,7 +210,12 @@ namespace triqs_cthyb {
     h5_read(grp, "measure_density_matrix", sp.measure_density_matrix);
     h5_read(grp, "use_norm_as_weight", sp.use_norm_as_weight);
     h5_read(grp, "performance_analysis", sp.performance_analysis);
+    h5_try_read(grp, "n_trace_threads", sp.n_trace_threads);
+    h5_try_read(grp, "use_state_propagation", sp.use_state_propagation);
+    h5_try_read(grp, "state_propagation_cutoff", sp.state_propagation_cutoff);
+    h5_try_read(grp, "use_float_estimates", sp.use_float_estimates);
     h5_read(grp, "proposal_prob", sp.proposal_prob);
+    h5_try_read(grp, "tune_proposal_prob", sp.tune_proposal_prob);
 
     //h5_read(grp, "move_global", sp.move_global);
     if( grp.has_key("move_global") )
@@ -94,6 +94,14 @@ namespace triqs_cthyb {
     /// default: 5000
     int n_warmup_cycles = 5000;
 
+    /// Stop the warmup before n_warmup_cycles once the perturbation order, the sign and the atomic weight
+    /// of the configurations are stationary?
+    bool stop_warmup_when_stationary = false;
+
+    /// Set length_cycle from the auto-correlation time of the perturbation order, measured at the end of the warmup?
+    /// The last quarter of the warmup is used. The value chosen is given by tuned_length_cycle
+    bool tune_length_cycle = false;
+
     /// Seed for random number generator
     /// default: 34788 + 928374 * MPI.rank
     int random_seed = 34788 + 928374 * mpi::communicator().rank();
@@ -116,7 +124,11 @@ namespace triqs_cthyb {
     /// Add double insertions as a move?
     bool move_double = true;
 
-    /// Calculate the full trace or use an estimate?
+    /// Add local insertions and removals as moves? Width of their time window, 0 < local_move_window < beta
+    /// default: 0 = no local moves
+    double local_move_window = 0.0;
+
+    /// Use abs(Tr_B), B the first non zero block in the order of the bounds, as the weight? Not with use_norm_as_weight
     bool use_trace_estimator = false;
 
     /// Measure G(tau)? :math:`G_{ij}(\tau)=G_{ji}^*(\tau)` is enforced for the resulting G(tau)
@@ -131,6 +143,12 @@ namespace triqs_cthyb {
     /// Minumum of operator insertions in: O_tau by insertion measure
     int measure_O_tau_min_ins = 10;
 
+    /// Measure the matrix O_tau[a, b] as measure_O_tau with (O_a, O_b), for all pairs of a list of operators
+    std::optional<std::vector<many_body_op_t>> measure_O_tau_matrix = {};
+
+    /// Measure chi_static[a, b] = int dtau <O_a(tau) O_b(0)>, for a list of operators commuting with h_loc
+    std::optional<std::vector<many_body_op_t>> measure_chi_static = {};
+
     /// Measure G^4(tau,tau',tau'') with three fermionic times.
     bool measure_G2_tau = false;
 
@@ -196,11 +214,28 @@ namespace triqs_cthyb {
     /// Analyse performance of trace computation with histograms (developers only)?
     bool performance_analysis = false;
 
+    /// Number of threads evaluating the blocks of the trace concurrently (1: serial evaluation)
+    int n_trace_threads = 1;
+
+    /// Trace by propagating the low-energy states through the operators, without block matrix products?
+    bool use_state_propagation = false;
+
+    /// With use_state_propagation, only the states with exp(-beta (E - E_0)) > state_propagation_cutoff are traced
+    /// Uncontrolled approximation: a dropped state contributes up to exp(-(beta - (tau_last - tau_first)) (E - E_0))
+    double state_propagation_cutoff = 1.e-12;
+
+    /// Check the Yee rejection on single precision estimates of the trace before the double precision evaluation?
+    bool use_float_estimates = false;
+
     /// Operator insertion/removal probabilities for different blocks
     /// type: dict(str:float)
     /// default: {}
     std::map<std::string, double> proposal_prob = {};
 
+    /// Tune the insertion/removal probabilities of the blocks during the warmup, starting from proposal_prob?
+    /// The tuned values are given by tuned_proposal_prob, and can be reused as proposal_prob
+    bool tune_proposal_prob = false;
+
     /// List of global moves (with their names).
     /// Each move is specified with an index substitution dictionary.
     /// type: dict(str : dict(indices : indices))
@@ -20,15 +20,65 @@
  ******************************************************************************/
 #pragma once
 #include "impurity_trace.hpp"
+#include "impurity_trace_wide.hpp"
+#include "config_parity.hpp"
 #include <triqs/gfs.hpp>
 #include <triqs/mesh.hpp>
 #include <triqs/det_manip.hpp>
+#include <optional>
 
 namespace triqs_cthyb {
   using namespace triqs::gfs;
   using namespace triqs::mesh;
   using namespace nda;
 
+#ifdef TRACE_WIDE_TREE
+  using impurity_trace_t = impurity_trace_wide;
+#else
+  using impurity_trace_t = impurity_trace;
+#endif
+
+  // The number of C^dagger (dagger) or C operators of det at times larger than tau : the position of an operator at tau.
+  // The det stores the operators in decreasing time order : binary search.
+  template <typename Det> int det_position(Det const &det, time_pt const &tau, bool dagger) {
+    int lo = 0, hi = det.size();
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if ((dagger ? det.get_x(mid) : det.get_y(mid)).first < tau)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    return lo;
+  }
+
+  // The window of the local insertions and removals : a C is paired with a C^dagger at tau if it is at a time in
+  // [tau - width / 2, tau + width / 2), with cyclicity. 0 < width < beta.
+  struct time_window {
+    time_pt half_width, width;
+
+    time_window(time_segment const &tau_seg, double w) : half_width(tau_seg.make_time_pt(w / 2)), width(tau_seg.make_time_pt(w)) {}
+
+    time_pt lower(time_pt const &tau) const { return tau - half_width; }
+
+    bool contains(time_pt const &tau, time_pt const &t) const { return (t - lower(tau)) < width; }
+
+    // A random time in the window of tau
+    template <typename RNG> time_pt get_random_pt(time_segment const &tau_seg, RNG &rng, time_pt const &tau) const {
+      return lower(tau) + tau_seg.get_random_pt(rng, width);
+    }
+
+    // The number of C of det in the window of tau, and the position of the first one.
+    // The others follow it, modulo the size of det.
+    template <typename Det> std::pair<int, int> find_c(Det const &det, time_pt const &tau) const {
+      int n = det.size();
+      if (n == 0) return {0, 0};
+      auto lo = lower(tau), hi = lo + width;
+      int pos_lo = det_position(det, lo, false), pos_hi = det_position(det, hi, false);
+      return {pos_lo - pos_hi + (hi < lo ? n : 0), pos_hi % n};
+    }
+  };
+
   /************************
  * The Monte Carlo data
  ***********************/
@@ -38,7 +88,7 @@ namespace triqs_cthyb {
     time_segment tau_seg;
     std::map<std::pair<int, int>, int> linindex; // Linear index constructed from block and inner indices
     atom_diag const &h_diag;                     // Diagonalization of the atomic problem
-    mutable impurity_trace imp_trace;            // Calculator of the trace
+    mutable impurity_trace_t imp_trace;          // Calculator of the trace
     std::vector<int> n_inner;
     block_gf<imtime, delta_target_t> delta; // Hybridization function
 
@@ -64,7 +114,7 @@ namespace triqs_cthyb {
     std::vector<det_manip::det_manip<delta_block_adaptor>> dets; // The determinants
     int current_sign, old_sign;                                  // Permutation prefactor
     h_scalar_t atomic_weight;                                    // The current value of the trace or norm
-    h_scalar_t atomic_reweighting;                               // The current value of the reweighting
+    bool use_trace_estimator;                                    // The weight is an estimate of the trace
 
     // Construction
     qmc_data(double beta, solve_parameters_t const &p, atom_diag const &h_diag, std::map<std::pair<int, int>, int> linindex,
@@ -73,12 +123,15 @@ namespace triqs_cthyb {
          tau_seg(beta),
          linindex(linindex),
          h_diag(h_diag),
-         imp_trace(beta, h_diag, histo_map, p.use_norm_as_weight, p.measure_density_matrix, p.performance_analysis),
+         imp_trace(beta, h_diag, histo_map, p.use_norm_as_weight, p.measure_density_matrix, p.performance_analysis, p.n_trace_threads,
+                   p.use_trace_estimator, p.use_state_propagation, p.state_propagation_cutoff,
+                   p.use_float_estimates),
          n_inner(n_inner),
          delta(map([](gf_const_view<imtime> d) { return real(d); }, delta)),
          current_sign(1),
-         old_sign(1) {
-      std::tie(atomic_weight, atomic_reweighting) = imp_trace.compute();
+         old_sign(1),
+         use_trace_estimator(p.use_trace_estimator) {
+      std::tie(atomic_weight, reweighting) = imp_trace.compute_full();
       dets.clear();
       for (auto const &bl : range(delta.size())) {
 #ifdef HYBRIDISATION_IS_COMPLEX
@@ -104,32 +157,62 @@ namespace triqs_cthyb {
     qmc_data(qmc_data const &) = delete; // Member imp_trace is not copyable
     qmc_data &operator=(qmc_data const &) = delete;
 
+    // Set the weight of the configuration after a move, once the trace is confirmed.
+    // With the trace estimator, the move only has the estimate : the reweighting needs the full trace,
+    // which is computed on its first read, see atomic_reweighting.
+    void set_atomic_weight(h_scalar_t weight, h_scalar_t new_reweighting) {
+      atomic_weight = weight;
+      if (use_trace_estimator)
+        reweighting_is_valid = false;
+      else
+        reweighting = new_reweighting;
+    }
+
+    // The current value of the reweighting.
+    // With the trace estimator, the full trace is computed here, only when a measure needs it : at most once per cycle,
+    // instead of after each accepted move.
+    h_scalar_t atomic_reweighting() const {
+      if (!reweighting_is_valid) {
+        reweighting          = imp_trace.compute_full().second;
+        reweighting_is_valid = true;
+      }
+      return reweighting;
+    }
+
+    // The parity of the permutation bringing the operators of the configuration to
+    // d^_1 d^_1 d^_1 ... d_1 d_1 d_1   d^_2 d^_2 ... d_2 d_2   ...   d^_n .. d_n (config_parity.hpp)
+    int config_parity = 0;
+
+    // Recompute the sign from the whole configuration
     void update_sign() {
+      config_parity = compute_config_parity();
+      set_sign();
+    }
 
-      int s             = 0;
-      size_t num_blocks = dets.size();
-      std::vector<int> n_op_with_a_equal_to(num_blocks, 0), n_ndag_op_with_a_equal_to(num_blocks, 0);
+    // Update the sign after a move which added or removed the changed operators, once the tree is confirmed.
+    // Only the pairs with a changed operator are counted, see config_parity_change.
+    void update_sign(std::initializer_list<changed_op_t> changed) {
+      config_parity = (config_parity + config_parity_change(imp_trace, changed, n_op_above, n_op_total)) % 2;
+      set_sign();
 
-      // In this first part we compute the sign to bring the configuration to
-      // d^_1 d^_1 d^_1 ... d_1 d_1 d_1   d^_2 d^_2 ... d_2 d_2   ...   d^_n .. d_n
+#ifdef EXT_DEBUG
+      if (config_parity != compute_config_parity()) TRIQS_RUNTIME_ERROR << "update_sign : the parity of the configuration is wrong";
+#endif
+    }
 
-      // loop over the operators "op" in the trace (right to left)
-      for (auto const &op : config) {
+    private:
+    std::vector<int> n_op_above, n_op_total; // workspace of update_sign
+    mutable h_scalar_t reweighting;          // The reweighting, if reweighting_is_valid
+    mutable bool reweighting_is_valid = true;
 
-        // how many operators with an 'a' larger than "op" are there on the left of "op"?
-        for (int a = op.second.block_index + 1; a < num_blocks; ++a) s += n_op_with_a_equal_to[a];
-        n_op_with_a_equal_to[op.second.block_index]++;
+    int compute_config_parity() const { return triqs_cthyb::compute_config_parity(config, dets.size()); }
 
-        // if "op" is not a dagger how many operators of the same a but with a dagger are there on his right?
-        if (op.second.dagger)
-          s += n_ndag_op_with_a_equal_to[op.second.block_index];
-        else
-          n_ndag_op_with_a_equal_to[op.second.block_index]++;
-      }
+    void set_sign() {
+      int s = config_parity;
 
       // Now we compute the sign to bring the configuration to
       // d_1 d^_1 d_1 d^_1 ... d_1 d^_1   ...   d_n d^_n ... d_n d^_n
-      for (int block_index = 0; block_index < num_blocks; block_index++) {
+      for (int block_index = 0; block_index < dets.size(); block_index++) {
         int n = dets[block_index].size();
         s += n * (n + 1) / 2;
       }
@@ -0,0 +1,86 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <nda/nda.hpp>
+#include <nda/blas.hpp>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+namespace triqs_cthyb {
+
+  /// Largest dimension of the matrices multiplied by small_gemm_kernel
+  constexpr int small_gemm_max_dim = 16;
+
+  /**
+   * C = A * B, for row-major matrices with rows of stride lda, ldb, ldc.
+   * The inner dimension K is fixed at compile time : the loop over K is unrolled, the loop over the columns vectorized.
+   */
+  template <int K, typename T> void small_gemm_kernel(long m, long n, T const *a, long lda, T const *b, long ldb, T *c, long ldc) {
+    for (long i = 0; i < m; ++i) {
+      T *ci = c + i * ldc;
+      for (long j = 0; j < n; ++j) ci[j] = 0;
+      for (int k = 0; k < K; ++k) {
+        T aik        = a[i * lda + k];
+        T const *bk = b + k * ldb;
+        for (long j = 0; j < n; ++j) ci[j] += aik * bk[j];
+      }
+    }
+  }
+
+  /// C = A * B, with a plain loop, for any layout and scalar type
+  template <typename MA, typename MB, typename MC> void generic_gemm(MA const &A, MB const &B, MC &C) {
+    using T = std::remove_const_t<typename MC::value_type>;
+    long m = A.shape()[0], k = A.shape()[1], n = B.shape()[1];
+    for (long i = 0; i < m; ++i)
+      for (long j = 0; j < n; ++j) {
+        T s = 0;
+        for (long l = 0; l < k; ++l) s += A(i, l) * B(l, j);
+        C(i, j) = s;
+      }
+  }
+
+  /**
+   * C = A * B.
+   * When all the dimensions are at most small_gemm_max_dim, the kernel for the inner dimension is dispatched once,
+   * which avoids the overhead of the BLAS call for the small blocks. Otherwise, or for non row-major layouts, BLAS gemm,
+   * or a plain loop for the types BLAS does not support (the single precision estimates).
+   */
+  template <typename MA, typename MB, typename MC> void small_gemm(MA const &A, MB const &B, MC &C) {
+    using T = std::remove_const_t<typename MC::value_type>;
+    long m = A.shape()[0], k = A.shape()[1], n = B.shape()[1];
+    bool small = (m <= small_gemm_max_dim) && (k <= small_gemm_max_dim) && (n <= small_gemm_max_dim) && (k > 0);
+    bool row_major = (A.indexmap().strides()[1] == 1) && (B.indexmap().strides()[1] == 1) && (C.indexmap().strides()[1] == 1);
+    if (!small || !row_major) {
+      if constexpr (nda::is_blas_lapack_v<T>)
+        nda::blas::gemm(1, A, B, 0, C);
+      else
+        generic_gemm(A, B, C);
+      return;
+    }
+    using kernel_t = void (*)(long, long, T const *, long, T const *, long, T *, long);
+    static constexpr auto kernels = []<int... K>(std::integer_sequence<int, K...>) {
+      return std::array<kernel_t, sizeof...(K)>{&small_gemm_kernel<K + 1, T>...};
+    }(std::make_integer_sequence<int, small_gemm_max_dim>{});
+    kernels[k - 1](m, n, A.data(), A.indexmap().strides()[0], B.data(), B.indexmap().strides()[0], C.data(), C.indexmap().strides()[0]);
+  }
+
+} // namespace triqs_cthyb
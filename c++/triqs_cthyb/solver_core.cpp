@@ -36,9 +36,12 @@
 #include "./moves/double_remove.hpp"
 #include "./moves/shift.hpp"
 #include "./moves/global.hpp"
+#include "./moves/adaptive_move_set.hpp"
+#include "./warmup_monitor.hpp"
 #include "./measures/G_tau.hpp"
 #include "./measures/G_l.hpp"
 #include "./measures/O_tau_ins.hpp"
+#include "./measures/chi_static.hpp"
 #include "./measures/perturbation_hist.hpp"
 #include "./measures/density_matrix.hpp"
 #include "./measures/average_sign.hpp"
@@ -260,6 +263,9 @@ namespace triqs_cthyb {
       return;
     }
 
+    if (params.use_trace_estimator && params.use_norm_as_weight)
+      TRIQS_RUNTIME_ERROR << "use_trace_estimator and use_norm_as_weight can not be used together : both replace the trace by another weight";
+
     // Initialise Monte Carlo quantities
     qmc_data data(beta, params, h_diag, linindex, _Delta_tau, n_inner, histo_map);
     auto qmc =
@@ -275,20 +281,43 @@ namespace triqs_cthyb {
     move_set_type double_inserts(qmc.get_rng());
     move_set_type double_removes(qmc.get_rng());
 
+    // Local moves : the C are drawn close to the C^dagger, in addition to the moves over the whole [0, beta)
+    double window = params.local_move_window;
+    if (window < 0 || window >= beta) TRIQS_RUNTIME_ERROR << "local_move_window must be in [0, beta)";
+
     auto &delta_names  = _Delta_tau.block_names();
     auto get_prob_prop = [&params](std::string const &block_name) {
       auto f = params.proposal_prob.find(block_name);
       return (f != params.proposal_prob.end() ? f->second : 1.0);
     };
 
+    // With tune_proposal_prob, the probabilities of the blocks in the inserts and removes of two operators are tuned during the warmup
+    std::shared_ptr<proposal_tuner> tuner;
+    if (params.tune_proposal_prob) {
+      std::vector<double> priors;
+      for (auto const &block_name : delta_names) priors.push_back(get_prob_prop(block_name));
+      tuner = std::make_shared<proposal_tuner>(delta_names, priors);
+    }
+    adaptive_move_set tuned_inserts(qmc.get_rng(), tuner), tuned_removes(qmc.get_rng(), tuner);
+
     for (size_t block = 0; block < _Delta_tau.size(); ++block) {
       int block_size         = _Delta_tau[block].data().shape()[1];
       auto const &block_name = delta_names[block];
       double prop_prob       = get_prob_prop(block_name);
-      inserts.add(move_insert_c_cdag(block, block_size, block_name, data, qmc.get_rng(), histo_map),
-                  "Insert Delta_" + block_name, prop_prob);
-      removes.add(move_remove_c_cdag(block, block_size, block_name, data, qmc.get_rng(), histo_map),
-                  "Remove Delta_" + block_name, prop_prob);
+      auto add_insert_remove = [&](auto &&insert, auto &&remove, std::string const &suffix) {
+        if (tuner) {
+          tuned_inserts.add(std::move(insert), block);
+          tuned_removes.add(std::move(remove), block);
+        } else {
+          inserts.add(std::move(insert), "Insert Delta_" + block_name + suffix, prop_prob);
+          removes.add(std::move(remove), "Remove Delta_" + block_name + suffix, prop_prob);
+        }
+      };
+      add_insert_remove(move_insert_c_cdag(block, block_size, block_name, data, qmc.get_rng(), histo_map),
+                        move_remove_c_cdag(block, block_size, block_name, data, qmc.get_rng(), histo_map), "");
+      if (window > 0)
+        add_insert_remove(move_insert_c_cdag(block, block_size, block_name + "_local", data, qmc.get_rng(), histo_map, window),
+                          move_remove_c_cdag(block, block_size, block_name + "_local", data, qmc.get_rng(), histo_map, window), " (local)");
       if (params.move_double) {
         for (size_t block2 = 0; block2 < _Delta_tau.size(); ++block2) {
           int block_size2         = _Delta_tau[block2].data().shape()[1];
@@ -302,12 +331,25 @@ namespace triqs_cthyb {
              move_remove_c_c_cdag_cdag(block, block2, block_size, block_size2, block_name,
                                        block_name2, data, qmc.get_rng(), histo_map),
              "Remove Delta_" + block_name + "_" + block_name2, prop_prob * prop_prob2);
+          if (window > 0) {
+            double_inserts.add(move_insert_c_c_cdag_cdag(block, block2, block_size, block_size2, block_name + "_local", block_name2 + "_local",
+                                                         data, qmc.get_rng(), histo_map, window),
+                               "Insert Delta_" + block_name + "_" + block_name2 + " (local)", prop_prob * prop_prob2);
+            double_removes.add(move_remove_c_c_cdag_cdag(block, block2, block_size, block_size2, block_name + "_local", block_name2 + "_local",
+                                                         data, qmc.get_rng(), histo_map, window),
+                               "Remove Delta_" + block_name + "_" + block_name2 + " (local)", prop_prob * prop_prob2);
+          }
         }
       }
     }
 
-    qmc.add_move(std::move(inserts), "Insert two operators", 1.0);
-    qmc.add_move(std::move(removes), "Remove two operators", 1.0);
+    if (tuner) {
+      qmc.add_move(std::move(tuned_inserts), "Insert two operators", 1.0);
+      qmc.add_move(std::move(tuned_removes), "Remove two operators", 1.0);
+    } else {
+      qmc.add_move(std::move(inserts), "Insert two operators", 1.0);
+      qmc.add_move(std::move(removes), "Remove two operators", 1.0);
+    }
     if (params.move_double) {
       qmc.add_move(std::move(double_inserts), "Insert four operators", 1.0);
       qmc.add_move(std::move(double_removes), "Remove four operators", 1.0);
@@ -398,6 +440,33 @@ namespace triqs_cthyb {
          "O_tau insertion measure");
     }
 
+    if (params.measure_O_tau_matrix) {
+
+      auto const &ops = *params.measure_O_tau_matrix;
+      for (auto const &O : ops) {
+        auto comm = O * _h_loc - _h_loc * O;
+        if (!comm.is_zero())
+          TRIQS_RUNTIME_ERROR << "Error: measure_O_tau_matrix, supplied operator does not commute with "
+                                 "the local Hamiltonian.\n"
+                              << "[O, H_loc] = " << comm << "\n";
+      }
+      qmc.add_measure(measure_O_tau_matrix_ins{O_tau_matrix, data, n_tau, ops, params.measure_O_tau_min_ins, qmc.get_rng()},
+                      "O_tau_matrix insertion measure");
+    }
+
+    if (params.measure_chi_static) {
+
+      auto const &ops = *params.measure_chi_static;
+      for (auto const &O : ops) {
+        auto comm = O * _h_loc - _h_loc * O;
+        if (!comm.is_zero())
+          TRIQS_RUNTIME_ERROR << "Error: measure_chi_static, supplied operator does not commute with "
+                                 "the local Hamiltonian.\n"
+                              << "[O, H_loc] = " << comm << "\n";
+      }
+      qmc.add_measure(measure_chi_static{chi_static, data, ops}, "Static susceptibility measure");
+    }
+
     if (params.measure_G_tau) {
       G_tau = block_gf<imtime>{{beta, Fermion, n_tau}, gf_struct};
       qmc.add_measure(measure_G_tau{data, n_tau, gf_struct, container_set()}, "G_tau measure");
@@ -431,9 +500,67 @@ namespace triqs_cthyb {
     // --------------------------------------------------------------------------
 
     // Run! The empty (starting) configuration has sign = 1
-    _solve_status =
-       qmc.warmup_and_accumulate(params.n_warmup_cycles, params.n_cycles, params.length_cycle,
-                                 triqs::utility::clock_callback(params.max_time));
+    auto stop_callback = triqs::utility::clock_callback(params.max_time);
+
+    // With tune_length_cycle, the last quarter of the warmup is made of cycles of one move (see below)
+    int n_tune_cycles = (params.tune_length_cycle ? params.n_warmup_cycles / 4 : 0);
+
+    // With stop_warmup_when_stationary, the warmup stops as soon as the chain is stationary, after at most n_warmup_cycles
+    std::optional<warmup_monitor> monitor;
+    if (params.stop_warmup_when_stationary) monitor.emplace(data, params.n_warmup_cycles / 10);
+    bool stationary      = false;
+    auto warmup_callback = [&]() {
+      if (stop_callback()) return true;
+      return stationary = (monitor && (*monitor)());
+    };
+    _solve_status = qmc.warmup(params.n_warmup_cycles - n_tune_cycles, params.length_cycle, warmup_callback);
+    if (stationary) {
+      _solve_status = 0;
+      if (params.verbosity >= 2) std::cout << "Warmup stopped after " << monitor->get_n_cycles() << " cycles: the chain is stationary" << std::endl;
+    }
+
+    // The proposal probabilities are the same on all nodes, and fixed during the accumulation
+    _tuned_proposal_prob.clear();
+    if (tuner) {
+      tuner->freeze(_comm);
+      _tuned_proposal_prob = tuner->get_probs();
+      if (params.verbosity >= 2) {
+        std::cout << "Tuned proposal probabilities:";
+        for (auto const &[block_name, p] : _tuned_proposal_prob) std::cout << " " << block_name << " " << p;
+        std::cout << std::endl;
+      }
+    }
+
+    // The perturbation order is recorded after each move. Measurements separated by twice its auto-correlation time
+    // (in moves) are roughly decorrelated : it sets the length of the cycles of the accumulation.
+    // A poor estimate must not multiply the duration of the accumulation : it is at most max_tuned_length_cycle_factor
+    // times the length_cycle of the warmup.
+    constexpr int max_tuned_length_cycle_factor = 10;
+    int length_cycle                            = params.length_cycle;
+    _tuned_length_cycle                         = 0;
+    if (n_tune_cycles > 0) {
+      accumulator<double> order_acc = {0.0, -1, 0};
+      auto record_order             = [&]() {
+        order_acc << double(data.config.size());
+        return stop_callback();
+      };
+      if (_solve_status == 0) _solve_status = qmc.warmup(int64_t(n_tune_cycles) * params.length_cycle, 1, record_order);
+
+      auto [errs, counts] = order_acc.log_bin_errors_all_reduce(_comm);
+      double tau          = 0.0;
+      if (_comm.rank() == 0 && !errs.empty() && errs[0] > 0) tau = std::max(0.0, tau_estimate_from_errors(errs[int(0.7 * errs.size())], errs[0]));
+      mpi::broadcast(tau, _comm, 0);
+      double max_length_cycle = double(max_tuned_length_cycle_factor) * params.length_cycle;
+      length_cycle = _tuned_length_cycle = int(std::max(1.0, std::min(std::ceil(2 * tau), max_length_cycle)));
+      if (params.verbosity >= 2)
+        std::cout << "Auto-correlation time of the perturbation order: " << tau << " moves, length_cycle set to " << length_cycle << std::endl;
+      if (params.verbosity >= 1 && 2 * tau > max_length_cycle)
+        std::cout << "Warning: length_cycle is limited to " << max_tuned_length_cycle_factor
+                  << " times the length_cycle of the warmup. The auto-correlation time may be poorly estimated, or the warmup too short."
+                  << std::endl;
+    }
+
+    if (_solve_status == 0) _solve_status = qmc.accumulate(params.n_cycles, length_cycle, stop_callback);
     qmc.collect_results(_comm);
 
     if (params.verbosity >= 2) {
@@ -54,6 +54,10 @@ namespace triqs_cthyb {
     double _auto_corr_time;                // Auto-correlation time
     int _solve_status;                     // Status of the solve upon exit: 0 for clean termination, > 0 otherwise.
 
+    // Proposal probabilities of the blocks and length of the cycles tuned during the warmup
+    std::map<std::string, double> _tuned_proposal_prob;
+    int _tuned_length_cycle = 0;
+
     // Single-particle Green's function containers
     std::optional<G_iw_t> _G0_iw; // Non-interacting Matsubara Green's function
     G_tau_t _Delta_tau; // Imaginary-time Hybridization function
@@ -153,6 +157,12 @@ namespace triqs_cthyb {
     /// Status of the ``solve()`` on exit.
     int solve_status() const { return _solve_status; }
 
+    /// Proposal probabilities of the blocks tuned during the warmup (tune_proposal_prob), to be reused as proposal_prob
+    std::map<std::string, double> const &tuned_proposal_prob() const { return _tuned_proposal_prob; }
+
+    /// Length of the cycles of the accumulation set at the end of the warmup (tune_length_cycle), 0 if not tuned
+    int tuned_length_cycle() const { return _tuned_length_cycle; }
+
     /// is cthyb compiled with support for complex hybridization?
     bool hybridisation_is_complex() const {
 #ifdef HYBRIDISATION_IS_COMPLEX
@@ -193,6 +203,8 @@ namespace triqs_cthyb {
       h5_write(grp, "average_order", s._average_order);
       h5_write(grp, "auto_corr_time", s._auto_corr_time);
       h5_write(grp, "solve_status", s._solve_status);
+      h5_write(grp, "tuned_proposal_prob", s._tuned_proposal_prob);
+      h5_write(grp, "tuned_length_cycle", s._tuned_length_cycle);
       h5_write(grp, "Delta_infty_vec", s.Delta_infty_vec);
     }
 
@@ -214,6 +226,8 @@ namespace triqs_cthyb {
       h5_try_read(grp, "average_order", s._average_order);
       h5_try_read(grp, "auto_corr_time", s._auto_corr_time);
       h5_try_read(grp, "solve_status", s._solve_status);
+      h5_try_read(grp, "tuned_proposal_prob", s._tuned_proposal_prob);
+      h5_try_read(grp, "tuned_length_cycle", s._tuned_length_cycle);
       h5_try_read(grp, "Delta_infty_vec", s.Delta_infty_vec);
 
       return s;
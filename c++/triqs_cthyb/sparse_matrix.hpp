@@ -0,0 +1,79 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <nda/nda.hpp>
+#include <optional>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  /// Largest fraction of non zero elements for which a block matrix of an operator is kept in sparse form
+  constexpr double sparse_density_max = 0.2;
+
+  /// A matrix in compressed sparse row (CSR) form
+  template <typename T> struct csr_matrix {
+    long n_rows = 0, n_cols = 0;
+    std::vector<long> row_begin; // the non zero elements of row i are [row_begin[i], row_begin[i+1])
+    std::vector<int> cols;
+    std::vector<T> values;
+
+    csr_matrix() = default;
+    explicit csr_matrix(nda::matrix<T> const &m) : n_rows(m.shape()[0]), n_cols(m.shape()[1]) {
+      row_begin.push_back(0);
+      for (long i = 0; i < n_rows; ++i) {
+        for (long j = 0; j < n_cols; ++j)
+          if (m(i, j) != T(0)) {
+            cols.push_back(j);
+            values.push_back(m(i, j));
+          }
+        row_begin.push_back(cols.size());
+      }
+    }
+  };
+
+  /// The CSR form of m if its fraction of non zero elements is at most sparse_density_max
+  template <typename T> std::optional<csr_matrix<T>> sparse_form(nda::matrix<T> const &m) {
+    long nnz = 0;
+    for (long i = 0; i < m.shape()[0]; ++i)
+      for (long j = 0; j < m.shape()[1]; ++j) nnz += (m(i, j) != T(0));
+    if (nnz > sparse_density_max * m.shape()[0] * m.shape()[1]) return {};
+    return csr_matrix<T>{m};
+  }
+
+  /**
+   * C = diag(l) * A * diag(r) * B, with A sparse and B, C dense. l, r : null for the identity.
+   * nnz(A) x (columns of B) operations instead of (rows x columns of A) x (columns of B).
+   */
+  template <typename T, typename MB, typename MC> void csr_gemm(csr_matrix<T> const &A, double const *l, double const *r, MB const &B, MC &C) {
+    long nc = B.shape()[1];
+    for (long i = 0; i < A.n_rows; ++i) {
+      for (long j = 0; j < nc; ++j) C(i, j) = 0;
+      for (long p = A.row_begin[i]; p < A.row_begin[i + 1]; ++p) {
+        int k = A.cols[p];
+        T a   = (r ? A.values[p] * r[k] : A.values[p]);
+        for (long j = 0; j < nc; ++j) C(i, j) += a * B(k, j);
+      }
+      if (l)
+        for (long j = 0; j < nc; ++j) C(i, j) *= l[i];
+    }
+  }
+
+} // namespace triqs_cthyb
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  /**
+   * A fixed set of threads, running batches of tasks.
+   *
+   * The threads are started once, and wait for the next batch between two calls of run.
+   * The calling thread takes part in the work : a pool of size n has n-1 worker threads.
+   */
+  class thread_pool {
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable cv_start, cv_done;
+    long generation = 0; // incremented at each batch
+    bool stop       = false;
+    int n_busy      = 0; // number of workers still on the current batch
+    std::exception_ptr error;
+
+    // the current batch : tasks [0, n_tasks), run as job_call(job, task, thread)
+    void const *job                          = nullptr;
+    void (*job_call)(void const *, int, int) = nullptr;
+    int n_tasks                              = 0;
+    std::atomic<int> next_task               = 0;
+
+    void work(int thread) {
+      for (int t = next_task++; t < n_tasks; t = next_task++) {
+        try {
+          job_call(job, t, thread);
+        } catch (...) {
+          std::lock_guard lock(mutex);
+          if (!error) error = std::current_exception();
+        }
+      }
+    }
+
+    void worker_loop(int thread) {
+      long seen = 0;
+      while (true) {
+        {
+          std::unique_lock lock(mutex);
+          cv_start.wait(lock, [&] { return stop || generation != seen; });
+          if (stop) return;
+          seen = generation;
+        }
+        work(thread);
+        std::lock_guard lock(mutex);
+        if (--n_busy == 0) cv_done.notify_one();
+      }
+    }
+
+    public:
+    /// A pool of n_threads threads, the calling one included
+    explicit thread_pool(int n_threads) {
+      for (int i = 1; i < n_threads; ++i) workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+      {
+        std::lock_guard lock(mutex);
+        stop = true;
+      }
+      cv_start.notify_all();
+      for (auto &w : workers) w.join();
+    }
+
+    thread_pool(thread_pool const &) = delete;
+    thread_pool &operator=(thread_pool const &) = delete;
+
+    /// Number of threads, the calling one included
+    int size() const { return workers.size() + 1; }
+
+    /**
+     * Run f(task, thread) for all task in [0, n), and return when they are all done.
+     * thread in [0, size()) identifies the thread running the task, e.g. to use a per-thread workspace.
+     * The first exception thrown by a task is rethrown.
+     */
+    template <typename F> void run(int n, F const &f) {
+      if (workers.empty() || n <= 1) {
+        for (int t = 0; t < n; ++t) f(t, 0);
+        return;
+      }
+      {
+        std::lock_guard lock(mutex);
+        job       = &f;
+        job_call  = [](void const *j, int t, int thread) { (*static_cast<F const *>(j))(t, thread); };
+        n_tasks   = n;
+        next_task = 0;
+        n_busy    = workers.size();
+        error     = nullptr;
+        ++generation;
+      }
+      cv_start.notify_all();
+      work(0);
+      std::unique_lock lock(mutex);
+      cv_done.wait(lock, [this] { return n_busy == 0; });
+      if (error) std::rethrow_exception(std::exchange(error, nullptr));
+    }
+  };
+
+} // namespace triqs_cthyb
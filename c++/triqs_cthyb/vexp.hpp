@@ -0,0 +1,71 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <bit>
+#include <cstdint>
+
+namespace triqs_cthyb {
+
+  // exp(x) for finite x, branch free, so that a loop over it is vectorized by the compiler.
+  // Cody-Waite reduction x = n ln2 + r, |r| <= ln2/2, Taylor polynomial of degree 13 for exp(r) (relative error < 2e-16),
+  // then multiplication by 2^n built in the exponent bits.
+  // NB : the range checks are done on integers, floating point comparisons would prevent the vectorization (trapping math).
+  inline double exp_kernel(double x) {
+    constexpr double log2e   = 1.4426950408889634;
+    constexpr double ln2_hi  = 6.93147180369123816490e-01; // upper bits of ln2, n * ln2_hi is exact
+    constexpr double ln2_lo  = 1.90821492927058770002e-10;
+    constexpr double shifter = 0x1.8p52; // adding it rounds to the nearest integer, which ends up in the low bits of the mantissa
+
+    double t = x * log2e + shifter;
+    double n = t - shifter;
+    double r = (x - n * ln2_hi) - n * ln2_lo;
+
+    double p = 1.0 / 6227020800.0; // 1/13!
+    p        = p * r + 1.0 / 479001600.0;
+    p        = p * r + 1.0 / 39916800.0;
+    p        = p * r + 1.0 / 3628800.0;
+    p        = p * r + 1.0 / 362880.0;
+    p        = p * r + 1.0 / 40320.0;
+    p        = p * r + 1.0 / 5040.0;
+    p        = p * r + 1.0 / 720.0;
+    p        = p * r + 1.0 / 120.0;
+    p        = p * r + 1.0 / 24.0;
+    p        = p * r + 1.0 / 6.0;
+    p        = p * r + 0.5;
+    p        = p * r + 1.0;
+    p        = p * r + 1.0;
+
+    // 2^n, with n + 1023 in the exponent bits. No double -> int64 conversion, which would not vectorize either.
+    // Out of the range of normal numbers : underflow to 0, overflow to inf.
+    constexpr std::int64_t inf_bits = std::int64_t{0x7FF} << 52;
+    std::int64_t n_int              = std::bit_cast<std::int64_t>(t) - std::bit_cast<std::int64_t>(shifter);
+    std::int64_t scale_bits         = (n_int + 1023) << 52;
+    scale_bits                      = (n_int < -1022 ? 0 : scale_bits);
+    scale_bits                      = (n_int > 1023 ? inf_bits : scale_bits);
+    return p * std::bit_cast<double>(scale_bits);
+  }
+
+  // out[i] = exp(-dtau * e[i]) for i in [0, n)
+  inline void exp_neg_scaled(double const *__restrict e, double dtau, double *__restrict out, int n) {
+    for (int i = 0; i < n; ++i) out[i] = exp_kernel(-dtau * e[i]);
+  }
+
+} // namespace triqs_cthyb
@@ -0,0 +1,87 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+
+#include "./warmup_monitor.hpp"
+#include "./qmc_data.hpp"
+#include <cmath>
+#include <complex>
+
+namespace triqs_cthyb {
+
+  bool warmup_monitor::operator()() {
+
+    // the sign of the weight of the configuration (its phase, real part, for a complex weight)
+    std::complex<double> w = data.atomic_weight * double(data.current_sign);
+    for (auto const &det : data.dets) w *= std::complex<double>(det.determinant());
+
+    return monitor.record({double(data.config.size()), std::real(w) / std::abs(w), std::log(std::abs(data.atomic_weight))});
+  }
+
+  //----------------
+
+  bool stationarity_monitor::record(obs_t const &obs) {
+
+    for (int k = 0; k < n_observables; ++k) batch_sum[k] += obs[k];
+    ++n_cycles;
+    if (++n_in_batch < batch_length) return false;
+
+    // end of a batch
+    obs_t mean;
+    for (int k = 0; k < n_observables; ++k) mean[k] = batch_sum[k] / batch_length;
+    batch_sum  = {};
+    n_in_batch = 0;
+    batch_means.push_back(mean);
+    if (batch_means.size() == 4 * n_batches) { // merge by pairs
+      for (int i = 0; i < 2 * n_batches; ++i)
+        for (int k = 0; k < n_observables; ++k) batch_means[i][k] = (batch_means[2 * i][k] + batch_means[2 * i + 1][k]) / 2;
+      batch_means.resize(2 * n_batches);
+      batch_length *= 2;
+    }
+    if (n_cycles < min_cycles || batch_means.size() < 2 * n_batches) return false;
+
+    n_agreements = (windows_agree() ? n_agreements + 1 : 0);
+    return n_agreements >= n_batches;
+  }
+
+  bool stationarity_monitor::windows_agree() const {
+    int n = batch_means.size();
+    // the batches of the second and of the last quarters of the run
+    std::array<std::pair<int, int>, 2> windows = {std::make_pair(n / 4, n / 2), std::make_pair(n - n / 4, n)};
+    for (int k = 0; k < n_observables; ++k) {
+      // mean and squared error of the mean of the windows
+      double m[2], err2[2];
+      for (int w = 0; w < 2; ++w) {
+        auto [first, last] = windows[w];
+        double s = 0, s2 = 0;
+        for (int i = first; i < last; ++i) {
+          s += batch_means[i][k];
+          s2 += batch_means[i][k] * batch_means[i][k];
+        }
+        int size = last - first;
+        m[w]     = s / size;
+        err2[w]  = std::max(0.0, s2 / size - m[w] * m[w]) / (size - 1);
+      }
+      if (std::abs(m[1] - m[0]) > 2 * std::sqrt(err2[0] + err2[1])) return false;
+    }
+    return true;
+  }
+
+} // namespace triqs_cthyb
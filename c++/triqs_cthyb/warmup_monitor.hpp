@@ -0,0 +1,87 @@
+/*******************************************************************************
+ *
+ * TRIQS: a Toolbox for Research in Interacting Quantum Systems
+ *
+ * Copyright (C) 2021, Simons Foundation
+ *
+ * TRIQS is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * TRIQS is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * TRIQS. If not, see <http://www.gnu.org/licenses/>.
+ *
+ ******************************************************************************/
+#pragma once
+#include <array>
+#include <vector>
+
+namespace triqs_cthyb {
+
+  struct qmc_data;
+
+  /**
+   * Decides when a sequence of observables, recorded after each cycle, is stationary.
+   *
+   * The observables are averaged over batches of cycles. The batches cover all the cycles since the
+   * start : when there are 4 * n_batches of them, they are merged by pairs and their length doubles.
+   * After each batch, once min_cycles cycles are done, the means over the second and the last quarters of the run are
+   * compared. The spread of the batch means in a quarter gives the error of its mean, also for correlated samples.
+   * The sequence is considered stationary when the means of all observables agree within two standard errors,
+   * for n_batches consecutive batches.
+   */
+  class stationarity_monitor {
+
+    public:
+    static constexpr int n_observables = 3;
+    using obs_t                        = std::array<double, n_observables>;
+
+    explicit stationarity_monitor(long min_cycles) : min_cycles(min_cycles) {}
+
+    // Record the observables of a cycle. Returns true when the sequence is stationary.
+    bool record(obs_t const &obs);
+
+    // The number of cycles recorded
+    long get_n_cycles() const { return n_cycles; }
+
+    private:
+    static constexpr int n_batches = 10;
+
+    long min_cycles;
+    long n_cycles     = 0;
+    long batch_length = 1;
+    long n_in_batch   = 0;
+    obs_t batch_sum{};
+    std::vector<obs_t> batch_means; // at most 4 * n_batches, oldest first
+    int n_agreements = 0;           // consecutive batches after which the windows agree
+
+    bool windows_agree() const;
+  };
+
+  /**
+   * Decides when the warmup can stop : once the perturbation order, the sign and the log of the atomic weight
+   * of the configuration are stationary (stationarity_monitor).
+   */
+  class warmup_monitor {
+
+    public:
+    warmup_monitor(qmc_data const &data, long min_cycles) : data(data), monitor(min_cycles) {}
+
+    // Record the configuration at the end of a cycle. Returns true when the chain is stationary.
+    bool operator()();
+
+    // The number of cycles recorded
+    long get_n_cycles() const { return monitor.get_n_cycles(); }
+
+    private:
+    qmc_data const &data;
+    stationarity_monitor monitor;
+  };
+
+} // namespace triqs_cthyb
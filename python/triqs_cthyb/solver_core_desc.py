@@ -63,6 +63,16 @@ c.add_member(c_name = "O_tau",
              read_only= True,
              doc = r"""General operator Green's function :math:`O(\tau)` in imaginary time.""")
 
+c.add_member(c_name = "O_tau_matrix",
+             c_type = "std::optional<gf<imtime, matrix_valued>>",
+             read_only= True,
+             doc = r"""Matrix of the operator Green's functions :math:`O_{ab}(\tau) = \langle O_a(\tau) O_b(0) \rangle` in imaginary time.""")
+
+c.add_member(c_name = "chi_static",
+             c_type = "std::optional<matrix<dcomplex>>",
+             read_only= True,
+             doc = r"""Static susceptibilities :math:`\chi_{ab} = \int_0^\beta d\tau \langle O_a(\tau) O_b(0) \rangle`.""")
+
 c.add_member(c_name = "G2_tau",
              c_type = "std::optional<G2_tau_t>",
              read_only= True,
@@ -173,6 +183,10 @@ c.add_method("""void solve (**triqs_cthyb::solve_parameters_t)""",
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | n_warmup_cycles               | int                                                      | 5000                          | Number of cycles for thermalization                                                                               |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| stop_warmup_when_stationary   | bool                                                     | false                         | Stop the warmup before n_warmup_cycles once the order, sign and weight of the configurations are stationary?      |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| tune_length_cycle             | bool                                                     | false                         | Set length_cycle from the auto-correlation time of the perturbation order, measured at the end of the warmup?     |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | random_seed                   | int                                                      | 34788 + 928374 * MPI.rank     | Seed for random number generator                                                                                  |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | random_name                   | str                                                      | ""                            | Name of random number generator                                                                                   |
@@ -185,7 +199,9 @@ c.add_method("""void solve (**triqs_cthyb::solve_parameters_t)""",
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | move_double                   | bool                                                     | true                          | Add double insertions as a move?                                                                                  |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
-| use_trace_estimator           | bool                                                     | false                         | Calculate the full trace or use an estimate?                                                                      |
+| local_move_window             | double                                                   | 0.0                           | Width of the time window of the local insertion and removal moves (0: no local moves)                             |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| use_trace_estimator           | bool                                                     | false                         | Use abs(Tr_B), B the first non zero block in the order of the bounds, as the weight? Not with use_norm_as_weight  |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | measure_G_tau                 | bool                                                     | true                          | Measure G(tau)? :math:`G_{ij}(\tau)=G_{ji}^*(\tau)` is enforced for the resulting G(tau)                          |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
@@ -195,6 +211,10 @@ c.add_method("""void solve (**triqs_cthyb::solve_parameters_t)""",
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | measure_O_tau_min_ins         | int                                                      | 10                            | Minumum of operator insertions in: O_tau by insertion measure                                                     |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| measure_O_tau_matrix          | std::optional<std::vector<many_body_op_t>>               | {}                            | Measure the matrix O_tau[a, b] as measure_O_tau with (O_a, O_b), for all pairs of a list of operators             |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| measure_chi_static            | std::optional<std::vector<many_body_op_t>>               | {}                            | Measure chi_static[a, b] = int dtau <O_a(tau) O_b(0)>, for a list of operators commuting with h_loc               |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | measure_G2_tau                | bool                                                     | false                         | Measure G^4(tau,tau',tau'') with three fermionic times.                                                           |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | measure_G2_iw                 | bool                                                     | false                         | Measure G^4(inu,inu',inu'') with three fermionic frequencies.                                                     |
@@ -237,8 +257,18 @@ c.add_method("""void solve (**triqs_cthyb::solve_parameters_t)""",
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | performance_analysis          | bool                                                     | false                         | Analyse performance of trace computation with histograms (developers only)?                                       |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| n_trace_threads               | int                                                      | 1                             | Number of threads evaluating the blocks of the trace concurrently (1: serial evaluation)                          |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| use_state_propagation         | bool                                                     | false                         | Trace by propagating the low-energy states through the operators, without block matrix products?                  |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| state_propagation_cutoff      | double                                                   | 1.e-12                        | With use_state_propagation, only the states with exp(-beta (E - E_0)) > state_propagation_cutoff are traced       |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| use_float_estimates           | bool                                                     | false                         | Check the Yee rejection on single precision estimates of the trace before the double precision evaluation?        |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | proposal_prob                 | dict(str:float)                                          | {}                            | Operator insertion/removal probabilities for different blocks                                                     |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
+| tune_proposal_prob            | bool                                                     | false                         | Tune the insertion/removal probabilities of the blocks during the warmup, starting from proposal_prob?            |
++-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | move_global                   | dict(str : dict(indices : indices))                      | {}                            | List of global moves (with their names). Each move is specified with an index substitution dictionary.            |
 +-------------------------------+----------------------------------------------------------+-------------------------------+-------------------------------------------------------------------------------------------------------------------+
 | move_global_prob              | double                                                   | 0.05                          | Overall probability of the global moves                                                                           |
@@ -317,6 +347,14 @@ c.add_property(name = "solve_status",
                getter = cfunction("int solve_status ()"),
                doc = r"""status of the ``solve()`` on exit.""")
 
+c.add_property(name = "tuned_proposal_prob",
+               getter = cfunction("std::map<std::string, double> tuned_proposal_prob ()"),
+               doc = r"""Proposal probabilities of the blocks tuned during the warmup (tune_proposal_prob), to be reused as proposal_prob""")
+
+c.add_property(name = "tuned_length_cycle",
+               getter = cfunction("int tuned_length_cycle ()"),
+               doc = r"""Length of the cycles of the accumulation set at the end of the warmup (tune_length_cycle), 0 if not tuned""")
+
 c.add_property(name = "hybridisation_is_complex",
                getter = cfunction("bool hybridisation_is_complex ()"),
                doc = r"""cthyb compiled with support for complex hybridization?""")
@@ -380,6 +418,16 @@ c.add_member(c_name = "n_warmup_cycles",
              doc = r"""Number of cycles for thermalization
      default: 5000""")
 
+c.add_member(c_name = "stop_warmup_when_stationary",
+             c_type = "bool",
+             initializer = """ false """,
+             doc = r"""Stop the warmup before n_warmup_cycles once the order, sign and weight of the configurations are stationary?""")
+
+c.add_member(c_name = "tune_length_cycle",
+             c_type = "bool",
+             initializer = """ false """,
+             doc = r"""Set length_cycle from the auto-correlation time of the perturbation order, measured at the end of the warmup?""")
+
 c.add_member(c_name = "random_seed",
              c_type = "int",
              initializer = """ 34788+928374*mpi::communicator().rank() """,
@@ -414,10 +462,15 @@ c.add_member(c_name = "move_double",
              initializer = """ true """,
              doc = r"""Add double insertions as a move?""")
 
+c.add_member(c_name = "local_move_window",
+             c_type = "double",
+             initializer = """ 0.0 """,
+             doc = r"""Width of the time window of the local insertion and removal moves (0: no local moves)""")
+
 c.add_member(c_name = "use_trace_estimator",
              c_type = "bool",
              initializer = """ false """,
-             doc = r"""Calculate the full trace or use an estimate?""")
+             doc = r"""Use abs(Tr_B), B the first non zero block in the order of the bounds, as the weight? Not with use_norm_as_weight""")
 
 c.add_member(c_name = "measure_G_tau",
              c_type = "bool",
@@ -439,6 +492,16 @@ c.add_member(c_name = "measure_O_tau_min_ins",
              initializer = """ 10 """,
              doc = r"""Minumum of operator insertions in: O_tau by insertion measure""")
 
+c.add_member(c_name = "measure_O_tau_matrix",
+             c_type = "std::optional<std::vector<many_body_op_t>>",
+             initializer = """ {} """,
+             doc = r"""Measure the matrix O_tau[a, b] as measure_O_tau with (O_a, O_b), for all pairs of a list of operators""")
+
+c.add_member(c_name = "measure_chi_static",
+             c_type = "std::optional<std::vector<many_body_op_t>>",
+             initializer = """ {} """,
+             doc = r"""Measure chi_static[a, b] = int dtau <O_a(tau) O_b(0)>, for a list of operators commuting with h_loc""")
+
 c.add_member(c_name = "measure_G2_tau",
              c_type = "bool",
              initializer = """ false """,
@@ -546,6 +609,27 @@ c.add_member(c_name = "performance_analysis",
              initializer = """ false """,
              doc = r"""Analyse performance of trace computation with histograms (developers only)?""")
 
+c.add_member(c_name = "n_trace_threads",
+             c_type = "int",
+             initializer = """ 1 """,
+             doc = r"""Number of threads evaluating the blocks of the trace concurrently (1: serial evaluation)""")
+
+c.add_member(c_name = "use_state_propagation",
+             c_type = "bool",
+             initializer = """ false """,
+             doc = r"""Trace by propagating the low-energy states through the operators, without block matrix products?""")
+
+c.add_member(c_name = "state_propagation_cutoff",
+             c_type = "double",
+             initializer = """ 1.e-12 """,
+             doc = r"""With use_state_propagation, only the states with exp(-beta (E - E_0)) > state_propagation_cutoff are traced
+     Uncontrolled approximation: a dropped state contributes up to exp(-(beta - (tau_last - tau_first)) (E - E_0))""")
+
+c.add_member(c_name = "use_float_estimates",
+             c_type = "bool",
+             initializer = """ false """,
+             doc = r"""Check the Yee rejection on single precision estimates of the trace before the double precision evaluation?""")
+
 c.add_member(c_name = "proposal_prob",
              c_type = "std::map<std::string, double>",
              initializer = """ {} """,
@@ -553,6 +637,11 @@ c.add_member(c_name = "proposal_prob",
      type: dict(str:float)
      default: {}""")
 
+c.add_member(c_name = "tune_proposal_prob",
+             c_type = "bool",
+             initializer = """ false """,
+             doc = r"""Tune the insertion/removal probabilities of the blocks during the warmup, starting from proposal_prob?""")
+
 c.add_member(c_name = "move_global",
              c_type = "std::map<std::string, indices_map_t>",
              initializer = """ {} """,
@@ -77,6 +77,11 @@ TEST(CtHyb, Anderson) {
   p.quantum_numbers  = qn;
   p.partition_method = "quantum_numbers";
 #endif
+#ifdef LOCAL
+  p.n_cycles          = 10 * n_cycles;
+  p.local_move_window = 2.0;
+  p.move_double       = true;
+#endif
 
   // Solve!
   solver.solve(p);
@@ -89,6 +94,11 @@ TEST(CtHyb, Anderson) {
 #ifdef QN
   filename += "_qn";
 #endif
+  // the local moves change the Markov chain : same reference, compared within the statistical errors
+  std::string ref_filename = filename;
+#ifdef LOCAL
+  filename += "_local";
+#endif
 
   auto & G_tau = *solver.G_tau;
   
@@ -105,12 +115,20 @@ TEST(CtHyb, Anderson) {
 
   gf<imtime> g;
   if (rank == 0) {
-    h5::file G_file(filename + ".ref.h5", 'r');
+    h5::file G_file(ref_filename + ".ref.h5", 'r');
 #ifdef BLOCK
     h5_read(G_file, "G_up", g);
     EXPECT_GF_NEAR(g, G_tau[0]);
     h5_read(G_file, "G_down", g);
     EXPECT_GF_NEAR(g, G_tau[1]);
+#elif defined(LOCAL)
+    h5_read(G_file, "G_tot", g);
+    // averages over 50 bins of 50 tau points
+    for (int a = 0; a < 2; ++a)
+      for (int k = 0; k < 50; ++k) {
+        auto bin = nda::range(50 * k, 50 * (k + 1));
+        EXPECT_NEAR(nda::sum(nda::real(g.data()(bin, a, a))) / 50, nda::sum(nda::real(G_tau[0].data()(bin, a, a))) / 50, 0.02);
+      }
 #else
     h5_read(G_file, "G_tot", g);
     EXPECT_GF_NEAR(g, G_tau[0]);
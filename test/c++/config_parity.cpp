@@ -0,0 +1,57 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace triqs::hilbert_space;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include <triqs_cthyb/impurity_trace_wide.hpp>
+#include <triqs_cthyb/config_parity.hpp>
+#include "./random_moves.hpp"
+
+using atom_diag_t = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>;
+
+// Checks the parity updated from the changed operators of each accepted move, as qmc_data::update_sign does it,
+// against the parity computed from the whole configuration, along a random sequence of single and double
+// insertions and removals, and shifts.
+template <typename Trace> void check_parity_along_random_sequence() {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+  atom_diag_t ad(random_moves_test::make_h(), fops);
+
+  double beta  = 10.0;
+  int n_blocks = 2;
+  Trace imp_trace(beta, ad, nullptr);
+  random_moves_test::random_moves moves(fops, beta, 42, imp_trace);
+
+  int parity = 0;
+  std::vector<int> n_op_above, n_op_total;
+  for (int step = 0; step < 2000; ++step) {
+    moves.try_move(60);
+    imp_trace.compute();
+    if (moves.rng() % 3 == 0) {
+      moves.cancel();
+      continue;
+    }
+    moves.confirm();
+    std::vector<triqs_cthyb::changed_op_t> changed;
+    for (auto const &x : moves.changed) changed.push_back({x.tau, x.op.block_index, x.op.dagger});
+    parity = (parity + triqs_cthyb::config_parity_change(imp_trace, changed, n_op_above, n_op_total)) % 2;
+    EXPECT_EQ(parity, triqs_cthyb::compute_config_parity(moves.config, n_blocks));
+  }
+}
+
+// -----------------------------------------------------------------------------
+TEST(config_parity, impurity_trace) { check_parity_along_random_sequence<triqs_cthyb::impurity_trace>(); }
+
+TEST(config_parity, impurity_trace_wide) { check_parity_along_random_sequence<triqs_cthyb::impurity_trace_wide>(); }
+
+MAKE_MAIN;
@@ -0,0 +1,123 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace nda;
+using namespace triqs::hilbert_space;
+using namespace triqs::atom_diag;
+using namespace triqs::operators;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include <triqs_cthyb/configuration.hpp> // for op_desc
+
+#include <random>
+
+// -----------------------------------------------------------------------------
+// The Yee check on the single precision estimates must never reject a move
+// that the double precision check keeps, along a random sequence of insertions
+// and removals. At low temperature, with an empty ground state, most traces
+// are far below the normal range of float (about e^-87).
+TEST(impurity_trace, float_estimates) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+
+  double U = 2.0, J = 0.3, mu = -6.0, t = 0.4;
+  many_body_operator_real H;
+  for (auto o : range(2)) {
+    H += -mu * (n("up", o) + n("dn", o)) + U * n("up", o) * n("dn", o);
+    for (auto s : {"up", "dn"}) H += -t * (c_dag(s, o) * c(s, 1 - o));
+  }
+  H += (U - 2 * J) * (n("up", 0) * n("dn", 1) + n("dn", 0) * n("up", 1));
+  H += (U - 3 * J) * (n("up", 0) * n("up", 1) + n("dn", 0) * n("dn", 1));
+
+  auto ad = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>(H, fops);
+
+  double beta = 20.0;
+  triqs_cthyb::impurity_trace imp_trace(beta, ad, nullptr);
+  triqs_cthyb::impurity_trace imp_trace_float(beta, ad, nullptr, false, false, false, 1, false, false, 1.e-12, true);
+  triqs_cthyb::time_segment tau_seg(beta);
+
+  // the configuration, as in configuration.hpp
+  std::map<triqs_cthyb::time_pt, triqs_cthyb::op_desc, std::greater<triqs_cthyb::time_pt>> config;
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> uniform(0, beta), uniform_01(0, 1);
+
+  // The Yee check with p_yee = u_yee * f / |W|, W the trace in double precision :
+  // the move must be kept for f >= 1, and is rejected or not for f < 1.
+  int n_small = 0, n_rejected = 0;
+  auto check = [&]() {
+    auto [w, r] = imp_trace.compute();
+    double W    = std::abs(w * r);
+    if (W == 0) return;
+    if (W < std::exp(-87.0)) ++n_small;
+    double u_yee = uniform_01(rng), f = 0.5 + uniform_01(rng);
+    double p_yee = u_yee * f / W;
+    auto [w_float, r_float] = imp_trace_float.compute(p_yee, u_yee);
+    if (w_float == 0) {
+      EXPECT_LT(f, 1.0);
+      ++n_rejected;
+    } else
+      EXPECT_NEAR(std::abs(w_float * r_float), W, 1e-10 * W);
+    imp_trace_float.compute(); // complete the evaluation before the confirmation, as after an accepted move
+  };
+
+  auto random_op = [&]() {
+    int block_index = rng() % 2, inner_index = rng() % 2;
+    long linear_index = fops[{std::string(block_index == 0 ? "up" : "dn"), inner_index}];
+    return triqs_cthyb::op_desc{block_index, inner_index, bool(rng() % 2), linear_index};
+  };
+
+  for (int step = 0; step < 2000; ++step) {
+    bool accept = rng() % 2;
+    if (config.size() < 40 && (config.empty() || rng() % 3 != 0)) {
+      // insert a pair
+      std::vector<std::pair<triqs_cthyb::time_pt, triqs_cthyb::op_desc>> inserted;
+      for (int i = 0; i < 2; ++i) {
+        auto tau = tau_seg.make_time_pt(uniform(rng));
+        if (config.count(tau)) continue;
+        auto op = random_op();
+        imp_trace.try_insert(tau, op);
+        imp_trace_float.try_insert(tau, op);
+        inserted.emplace_back(tau, op);
+      }
+      check();
+      if (accept) {
+        imp_trace.confirm_insert(), imp_trace_float.confirm_insert();
+        for (auto const &[tau, op] : inserted) config.insert({tau, op});
+      } else {
+        imp_trace.cancel_insert(), imp_trace_float.cancel_insert();
+      }
+    } else {
+      // remove the n-th operator of a given kind, in decreasing time
+      auto it = std::next(config.begin(), rng() % config.size());
+      auto op = it->second;
+      int n   = 0;
+      for (auto jt = config.begin(); jt != it; ++jt) n += (jt->second.dagger == op.dagger && jt->second.block_index == op.block_index);
+      auto tau       = imp_trace.try_delete(n, op.block_index, op.dagger);
+      auto tau_float = imp_trace_float.try_delete(n, op.block_index, op.dagger);
+      EXPECT_TRUE(tau == it->first && tau_float == it->first);
+      check();
+      if (accept) {
+        imp_trace.confirm_delete(), imp_trace_float.confirm_delete();
+        config.erase(it);
+      } else {
+        imp_trace.cancel_delete(), imp_trace_float.cancel_delete();
+      }
+    }
+  }
+
+  // the sequence must test the regime of the bug, and the rejection on the estimates
+  EXPECT_GT(n_small, 0);
+  EXPECT_GT(n_rejected, 0);
+}
+
+MAKE_MAIN;
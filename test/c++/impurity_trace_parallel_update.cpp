@@ -0,0 +1,93 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace triqs::hilbert_space;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include "./random_moves.hpp"
+
+using atom_diag_t = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>;
+
+// -----------------------------------------------------------------------------
+// A global move replaces all the operators of a large configuration : with a thread pool, the cache is updated
+// in parallel, when (number of nodes) x (number of blocks) >= parallel_update_cutoff = 2^14 (impurity_trace.hpp).
+// The traces must be the ones of a serial engine, after the replacement and along random moves
+// which use the caches of the replaced nodes.
+TEST(impurity_trace, parallel_update_cache) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+
+  // at large mu, the ground state is filled and the pairs c(tau) c_dag(tau + dtau) barely reduce the trace
+  atom_diag_t ad(random_moves_test::make_h(6.0), fops);
+
+  double beta                 = 10.0;
+  bool use_norm_as_weight     = false;
+  bool measure_density_matrix = false;
+  bool performance_analysis   = false;
+  int n_threads               = 4;
+  triqs_cthyb::impurity_trace imp_trace(beta, ad, nullptr);
+  triqs_cthyb::impurity_trace imp_trace_threads(beta, ad, nullptr, use_norm_as_weight, measure_density_matrix, performance_analysis, n_threads);
+
+  auto check = [&]() {
+    auto [w, r]     = imp_trace.compute();
+    auto [w_t, r_t] = imp_trace_threads.compute();
+    EXPECT_NEAR(std::abs(w * r), std::abs(w_t * r_t), 1e-10 * std::abs(w * r));
+    EXPECT_EQ(imp_trace.tree_size, imp_trace_threads.tree_size);
+    return std::abs(w * r);
+  };
+
+  // n_pairs pairs of operators of the same flavor, in disjoint time slots
+  int n_pairs = 1000;
+  random_moves_test::random_moves moves(fops, beta, 42, imp_trace, imp_trace_threads);
+  triqs_cthyb::time_segment tau_seg(beta);
+  for (int p = 0; p < n_pairs; ++p) {
+    auto op = moves.random_op(moves.rng() % 2, false);
+    moves.insert(tau_seg.make_time_pt((p + 0.25) * beta / n_pairs), op);
+    op.dagger = true;
+    moves.insert(tau_seg.make_time_pt((p + 0.5) * beta / n_pairs), op);
+  }
+  EXPECT_GE(2 * n_pairs * ad.n_subspaces(), 1 << 14);
+  EXPECT_GT(check(), 0);
+
+  // flip the spin of all the operators
+  auto flipped = [&](triqs_cthyb::configuration::oplist_t updated_ops) {
+    for (auto &[tau, op] : updated_ops) {
+      op.block_index  = 1 - op.block_index;
+      op.linear_index = fops[{std::string(op.block_index == 0 ? "up" : "dn"), op.inner_index}];
+    }
+    return updated_ops;
+  };
+
+  for (bool accept : {false, true, true}) {
+    auto updated_ops = flipped(moves.config);
+    imp_trace.try_replace(updated_ops), imp_trace_threads.try_replace(updated_ops);
+    EXPECT_GT(check(), 0);
+    if (accept) {
+      imp_trace.confirm_replace(), imp_trace_threads.confirm_replace();
+      moves.config = moves.trial = updated_ops;
+    } else
+      imp_trace.cancel_replace(), imp_trace_threads.cancel_replace();
+    check();
+  }
+
+  // moves in the large configuration
+  for (int step = 0; step < 500; ++step) {
+    moves.try_move(2 * n_pairs);
+    check();
+    if (moves.rng() % 2)
+      moves.confirm();
+    else
+      moves.cancel();
+  }
+}
+
+MAKE_MAIN;
@@ -0,0 +1,108 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace triqs::hilbert_space;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include "./random_moves.hpp"
+
+#include <cmath>
+
+using atom_diag_t = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>;
+
+// The engine with use_state_propagation, the other options as in the solver by default
+triqs_cthyb::impurity_trace make_propagating_trace(double beta, atom_diag_t const &ad, double state_propagation_cutoff) {
+  bool use_norm_as_weight     = false;
+  bool measure_density_matrix = false;
+  bool performance_analysis   = false;
+  int n_threads               = 1;
+  bool use_trace_estimator    = false;
+  bool use_state_propagation  = true;
+  return {beta, ad, nullptr, use_norm_as_weight, measure_density_matrix, performance_analysis, n_threads, use_trace_estimator, use_state_propagation,
+          state_propagation_cutoff};
+}
+
+double ground_state_energy(atom_diag_t const &ad) {
+  double e0 = ad.get_eigenvalue(0, 0);
+  for (int b = 1; b < ad.n_subspaces(); ++b) e0 = std::min(e0, ad.get_eigenvalue(b, 0));
+  return e0;
+}
+
+// Compares the trace with state propagation to the dense one, along a random sequence of moves with operators in [0, window].
+// As in the engine, the states j with E_j >= e_max = E_0 - log(cutoff) / beta are dropped from the trace of their block.
+// The operators have a norm <= 1 and the evolutions between the first and the last operators a norm <= exp(-span E_0):
+// the contribution of j is bounded by exp(-(beta - span) E_j - span E_0).
+void compare_to_dense(atom_diag_t const &ad, fundamental_operator_set const &fops, double beta, double state_propagation_cutoff, double window) {
+
+  triqs_cthyb::impurity_trace imp_trace(beta, ad, nullptr);
+  auto imp_trace_prop = make_propagating_trace(beta, ad, state_propagation_cutoff);
+
+  double e0 = ground_state_energy(ad), e_max = e0 - std::log(state_propagation_cutoff) / beta;
+
+  auto dropped_bound = [&](double span) {
+    double bound = 0;
+    for (int b = 0; b < ad.n_subspaces(); ++b)
+      for (int j = 0; j < ad.get_subspace_dim(b); ++j)
+        if (ad.get_eigenvalue(b, j) >= e_max) bound += std::exp(-(beta - span) * ad.get_eigenvalue(b, j) - span * e0);
+    return bound;
+  };
+
+  random_moves_test::random_moves moves(fops, beta, 42, imp_trace, imp_trace_prop);
+  moves.window = window;
+  for (int step = 0; step < 2000; ++step) {
+    moves.try_move(40);
+    auto [w, r]     = imp_trace.compute();
+    auto [w_p, r_p] = imp_trace_prop.compute();
+    EXPECT_LE(std::abs(w * r - w_p * r_p), dropped_bound(moves.trial_span()) + 1e-10 * std::abs(w * r) + 1e-14);
+    if (moves.rng() % 2)
+      moves.confirm();
+    else
+      moves.cancel();
+  }
+}
+
+// -----------------------------------------------------------------------------
+// With state_propagation_cutoff = 0, all states are propagated :
+// the trace must be the one of the dense evaluation.
+TEST(impurity_trace, state_propagation_all_states) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+  atom_diag_t ad(random_moves_test::make_h(), fops);
+
+  double beta = 10.0;
+  compare_to_dense(ad, fops, beta, 0.0, beta);
+}
+
+// With a cutoff, some blocks keep k < dim states : the trace differs from the dense one
+// by at most the contributions of the dropped states.
+TEST(impurity_trace, state_propagation_cutoff) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+  atom_diag_t ad(random_moves_test::make_h(), fops);
+
+  double beta = 10.0, state_propagation_cutoff = 1e-3;
+
+  double e_max = ground_state_energy(ad) - std::log(state_propagation_cutoff) / beta;
+  int n_truncated_blocks = 0;
+  for (int b = 0; b < ad.n_subspaces(); ++b) {
+    int k = 0;
+    while (k < ad.get_subspace_dim(b) && ad.get_eigenvalue(b, k) < e_max) ++k;
+    if (k > 0 && k < ad.get_subspace_dim(b)) ++n_truncated_blocks;
+  }
+  EXPECT_GT(n_truncated_blocks, 0);
+
+  // operators in [0, beta / 2] : the dropped states are suppressed by at least exp(-beta E_j / 2)
+  compare_to_dense(ad, fops, beta, state_propagation_cutoff, beta / 2);
+}
+
+MAKE_MAIN;
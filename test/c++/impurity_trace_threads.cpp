@@ -0,0 +1,83 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/operators/many_body_operator.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace triqs::hilbert_space;
+using namespace triqs::operators;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include <triqs_cthyb/impurity_trace_wide.hpp>
+#include "./random_moves.hpp"
+
+using atom_diag_t = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>;
+
+// Checks that the trace evaluated on n_threads threads is the one of the serial evaluation, along a random sequence of moves.
+// At beta = 1, several blocks have comparable bounds : the blocks are evaluated by rounds on the threads.
+// The operators S+ and S- are attached to the engines and kept in the configuration : their block connections are one-to-one,
+// so the rounds are still used. The weight is summed over the blocks in the serial order : it must be the same to the last bit,
+// as well as the decisions of the Yee rejection.
+template <typename Trace> void compare_to_serial(int n_threads, bool use_norm_as_weight) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+  atom_diag_t ad(random_moves_test::make_h(), fops);
+
+  double beta                 = 1.0;
+  bool measure_density_matrix = false;
+  bool performance_analysis   = false;
+  Trace imp_trace(beta, ad, nullptr, use_norm_as_weight, measure_density_matrix, performance_analysis, 1);
+  Trace imp_trace_threads(beta, ad, nullptr, use_norm_as_weight, measure_density_matrix, performance_analysis, n_threads);
+
+  random_moves_test::random_moves moves(fops, beta, 42, imp_trace, imp_trace_threads);
+
+  triqs_cthyb::many_body_op_t s_plus = c_dag("up", 0) * c("dn", 0), s_minus = c_dag("dn", 0) * c("up", 0);
+  for (auto const &op : {s_plus, s_minus}) {
+    auto aux_op = imp_trace.attach_aux_operator(op);
+    EXPECT_EQ(aux_op.linear_index, imp_trace_threads.attach_aux_operator(op).linear_index);
+    moves.insert(moves.random_time(), aux_op);
+  }
+
+  std::uniform_real_distribution<double> uniform(0, 1);
+  for (int step = 0; step < 2000; ++step) {
+    moves.try_move(40);
+    auto [w, r]     = imp_trace.compute();
+    auto [w_t, r_t] = imp_trace_threads.compute();
+    EXPECT_EQ(w, w_t);
+    EXPECT_EQ(r, r_t);
+
+    // the Yee rejection, for a threshold around the weight
+    double u_yee = 2 * std::abs(w) * uniform(moves.rng);
+    auto yee     = imp_trace.compute(1, u_yee);
+    auto yee_t   = imp_trace_threads.compute(1, u_yee);
+    EXPECT_EQ(yee.first, yee_t.first);
+    EXPECT_EQ(yee.second, yee_t.second);
+
+    if (moves.rng() % 2) {
+      // as in the solver, an accepted move is confirmed after a complete evaluation
+      imp_trace.compute(), imp_trace_threads.compute();
+      moves.confirm();
+    } else
+      moves.cancel();
+  }
+}
+
+// -----------------------------------------------------------------------------
+TEST(impurity_trace, threads) {
+  compare_to_serial<triqs_cthyb::impurity_trace>(4, false);
+  compare_to_serial<triqs_cthyb::impurity_trace>(4, true);
+}
+
+TEST(impurity_trace_wide, threads) {
+  compare_to_serial<triqs_cthyb::impurity_trace_wide>(4, false);
+  compare_to_serial<triqs_cthyb::impurity_trace_wide>(4, true);
+}
+
+MAKE_MAIN;
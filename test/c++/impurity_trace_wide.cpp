@@ -0,0 +1,55 @@
+// -----------------------------------------------------------------------------
+
+#include <triqs/test_tools/gfs.hpp>
+
+#include <triqs/atom_diag/atom_diag.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp> // gf_struct_t
+using gf_struct_t = triqs::hilbert_space::gf_struct_t;
+
+using namespace nda;
+using namespace triqs::hilbert_space;
+using namespace triqs::atom_diag;
+
+// -----------------------------------------------------------------------------
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/impurity_trace.hpp>
+#include <triqs_cthyb/impurity_trace_wide.hpp>
+#include "./random_moves.hpp"
+
+using random_moves_test::make_h;
+
+// Checks that two trace engines give the same trace, along a random sequence
+// of confirmed and cancelled moves.
+template <typename Trace1, typename Trace2>
+void compare_along_random_sequence(Trace1 &imp_trace, Trace2 &imp_trace_2, fundamental_operator_set const &fops, double beta) {
+
+  random_moves_test::random_moves moves(fops, beta, 42, imp_trace, imp_trace_2);
+  for (int step = 0; step < 2000; ++step) {
+    moves.try_move(60);
+    auto [w, r]     = imp_trace.compute();
+    auto [w_2, r_2] = imp_trace_2.compute();
+    EXPECT_NEAR(std::abs(w * r), std::abs(w_2 * r_2), 1e-10 * std::abs(w * r) + 1e-14);
+    EXPECT_EQ(imp_trace.tree_size, imp_trace_2.tree_size);
+    if (moves.rng() % 2)
+      moves.confirm();
+    else
+      moves.cancel();
+  }
+}
+
+// -----------------------------------------------------------------------------
+// The B-tree engine must give the same trace as the red black tree one.
+TEST(impurity_trace_wide, compare_to_rbt) {
+
+  gf_struct_t gf_struct{{"up", 2}, {"dn", 2}};
+  fundamental_operator_set fops(gf_struct);
+  auto ad = triqs::atom_diag::atom_diag<triqs_cthyb::is_h_scalar_complex>(make_h(), fops);
+
+  double beta = 10.0;
+  triqs_cthyb::impurity_trace imp_trace(beta, ad, nullptr);
+  triqs_cthyb::impurity_trace_wide imp_trace_wide(beta, ad, nullptr);
+  compare_along_random_sequence(imp_trace, imp_trace_wide, fops, beta);
+}
+
+MAKE_MAIN;
@@ -0,0 +1,182 @@
+// -----------------------------------------------------------------------------
+// Random sequences of moves, done in the same way on several trace engines,
+// for the tests comparing the engines and their options.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <triqs/test_tools/arrays.hpp>
+#include <triqs/hilbert_space/fundamental_operator_set.hpp>
+#include <triqs/operators/many_body_operator.hpp>
+
+#include <triqs_cthyb/types.hpp>
+#include <triqs_cthyb/configuration.hpp> // for op_desc
+
+#include <algorithm>
+#include <random>
+#include <tuple>
+#include <vector>
+
+namespace random_moves_test {
+
+  using namespace triqs::operators;
+  using triqs::hilbert_space::fundamental_operator_set;
+  using triqs_cthyb::op_desc;
+  using triqs_cthyb::time_pt;
+
+  // A two orbital Kanamori-like local Hamiltonian, for the blocks "up" and "dn"
+  inline many_body_operator_real make_h(double mu = 1.2) {
+    double U = 2.0, J = 0.3, t = 0.4;
+    many_body_operator_real H;
+    for (int o = 0; o < 2; ++o) {
+      H += -mu * (n("up", o) + n("dn", o)) + U * n("up", o) * n("dn", o);
+      for (auto s : {"up", "dn"}) H += -t * (c_dag(s, o) * c(s, 1 - o));
+    }
+    H += (U - 2 * J) * (n("up", 0) * n("dn", 1) + n("dn", 0) * n("up", 1));
+    H += (U - 3 * J) * (n("up", 0) * n("up", 1) + n("dn", 0) * n("dn", 1));
+    return H;
+  }
+
+  // An operator inserted or removed by a move
+  struct changed_op_t {
+    time_pt tau;
+    op_desc op;
+    bool inserted;
+  };
+
+  /**
+   * Random moves, as the moves of the solver do them : insertion and removal of one or two pairs of operators,
+   * and shift of one operator. All the engines are modified in the same way.
+   * After try_move, the caller computes the traces of the trial configuration, then calls confirm or cancel.
+   */
+  template <typename... Traces> class random_moves {
+
+    fundamental_operator_set fops;
+    triqs_cthyb::time_segment tau_seg;
+    std::tuple<Traces &...> traces;
+    enum class move_kind { insert, remove, shift } kind = move_kind::insert;
+
+    template <typename F> void for_each_trace(F &&f) {
+      std::apply([&f](auto &...t) { (f(t), ...); }, traces);
+    }
+
+    public:
+    std::mt19937 rng;
+    triqs_cthyb::configuration::oplist_t config; // the accepted configuration
+    triqs_cthyb::configuration::oplist_t trial;  // the configuration of the trial
+    std::vector<changed_op_t> changed;           // the operators inserted or removed by the trial
+    double window;                               // the operators are inserted in [0, window]
+
+    random_moves(fundamental_operator_set const &fops, double beta, int seed, Traces &...traces)
+       : fops(fops), tau_seg(beta), traces(traces...), rng(seed), window(beta) {}
+
+    time_pt random_time() {
+      std::uniform_real_distribution<double> uniform(0, window);
+      while (true) {
+        auto tau = tau_seg.make_time_pt(uniform(rng));
+        if (!config.count(tau) && !trial.count(tau)) return tau;
+      }
+    }
+
+    op_desc random_op(int block_index, bool dagger) {
+      int inner_index   = rng() % 2;
+      long linear_index = fops[{std::string(block_index == 0 ? "up" : "dn"), inner_index}];
+      return op_desc{block_index, inner_index, dagger, linear_index};
+    }
+
+    // Insert and confirm an operator. The moves never remove the auxiliary operators (negative linear_index).
+    void insert(time_pt tau, op_desc const &op) {
+      for_each_trace([&](auto &t) {
+        t.try_insert(tau, op);
+        t.compute();
+        t.confirm_insert();
+      });
+      config.insert({tau, op});
+      trial = config;
+    }
+
+    int n_aux() const {
+      return std::count_if(config.begin(), config.end(), [](auto const &x) { return x.second.linear_index < 0; });
+    }
+
+    private:
+    void try_insert(op_desc const &op) {
+      auto tau = random_time();
+      for_each_trace([&](auto &t) { t.try_insert(tau, op); });
+      trial.insert({tau, op});
+      changed.push_back({tau, op, true});
+    }
+
+    // As in the moves, the n-th operator of its kind in decreasing time, in the accepted configuration
+    void try_delete(time_pt tau) {
+      auto op = config.at(tau);
+      int n   = 0;
+      for (auto it = config.begin(); it->first != tau; ++it) n += (it->second.dagger == op.dagger && it->second.block_index == op.block_index);
+      for_each_trace([&](auto &t) {
+        auto tau_t = t.try_delete(n, op.block_index, op.dagger);
+        EXPECT_TRUE(tau_t == tau);
+      });
+      trial.erase(tau);
+      changed.push_back({tau, op, false});
+    }
+
+    time_pt random_removable() {
+      while (true) {
+        auto it = std::next(config.begin(), rng() % config.size());
+        if (it->second.linear_index >= 0 && trial.count(it->first)) return it->first;
+      }
+    }
+
+    public:
+    // Propose a random move, keeping at most max_size operators, auxiliary ones excluded
+    void try_move(int max_size) {
+      trial = config;
+      changed.clear();
+      int n_pairs     = 1 + rng() % 2;
+      int n_removable = config.size() - n_aux();
+      int r           = rng() % 6;
+      if (n_removable >= 2 * n_pairs && (r < 2 || (n_removable + 2 * n_pairs > max_size && r < 5))) {
+        kind = move_kind::remove;
+        for (int i = 0; i < 2 * n_pairs; ++i) try_delete(random_removable());
+      } else if (n_removable > 0 && r == 5) {
+        kind    = move_kind::shift;
+        auto tau = random_removable();
+        auto op  = config.at(tau);
+        try_delete(tau);
+        try_insert(random_op(op.block_index, op.dagger));
+      } else {
+        kind = move_kind::insert;
+        for (int p = 0; p < n_pairs; ++p) {
+          int block_index = rng() % 2;
+          try_insert(random_op(block_index, true));
+          try_insert(random_op(block_index, false));
+        }
+      }
+    }
+
+    void confirm() {
+      for_each_trace([&](auto &t) {
+        switch (kind) {
+          case move_kind::insert: t.confirm_insert(); break;
+          case move_kind::remove: t.confirm_delete(); break;
+          case move_kind::shift: t.confirm_shift(); break;
+        }
+      });
+      config = trial;
+    }
+
+    void cancel() {
+      for_each_trace([&](auto &t) {
+        switch (kind) {
+          case move_kind::insert: t.cancel_insert(); break;
+          case move_kind::remove: t.cancel_delete(); break;
+          case move_kind::shift: t.cancel_shift(); break;
+        }
+      });
+      trial = config;
+    }
+
+    // Time between the first and the last operators of the trial configuration
+    double trial_span() const { return trial.empty() ? 0 : double(trial.begin()->first) - double(trial.rbegin()->first); }
+  };
+
+} // namespace random_moves_test
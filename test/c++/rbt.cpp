@@ -3,6 +3,8 @@
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <vector>
+#include <algorithm>
 
 // We need this dummy wrapper type, because rb_tree is inherited
 // from its second template parameter, and C++ forbids inheritance
@@ -12,7 +14,7 @@ struct int_ {
   int_(int i = {}) : i(i) {}
 };
 
-int main() {
+TEST(rbt, print) {
 
   triqs::utility::rb_tree<int, int_> tree;
 
@@ -68,3 +70,60 @@ int main() {
   std::cout << "---" << std::endl;
   for (auto n : tree_copy) std::cout << n->key << std::endl;
 }
+
+// Value with a storage, kept when a node is recycled
+struct cache_ {
+  std::vector<double> data;
+  cache_(int n = 0) : data(n, n) {}
+  void reset(int n) { data.assign(n, n); }
+};
+
+TEST(rbt, pool) {
+
+  triqs::utility::rb_tree<int, cache_> tree;
+
+  for (int k = 0; k < 100; ++k) tree.emplace(k, 10);
+  EXPECT_EQ(tree.size(), 100);
+  EXPECT_EQ(tree.pool_size(), 0);
+
+  // a deleted node goes to the pool, with its value
+  double const *storage = tree.get(42)->data.data();
+  tree.delete_node(42);
+  EXPECT_EQ(tree.size(), 99);
+  EXPECT_EQ(tree.pool_size(), 1);
+
+  // and is reused by the next insertion : the storage of its value is kept
+  tree.emplace(1000, 5);
+  EXPECT_EQ(tree.pool_size(), 0);
+  auto n = tree.get(1000);
+  EXPECT_EQ(n->data.data(), storage);
+  EXPECT_EQ(n->data, std::vector<double>(5, 5));
+
+  // the nodes of the pool are reused before new ones are constructed
+  for (int k = 1; k < 50; k += 2) tree.delete_node(k);
+  EXPECT_EQ(tree.pool_size(), 25);
+  for (int k = 0; k < 10; ++k) tree.emplace(2000 + k, 3);
+  EXPECT_EQ(tree.pool_size(), 15);
+
+  // keys and values survive the compaction, in order
+  std::vector<std::pair<int, std::vector<double>>> before;
+  for (auto n : tree) before.emplace_back(n->key, n->data);
+  tree.compact();
+  EXPECT_EQ(tree.pool_size(), 15);
+  std::vector<std::pair<int, std::vector<double>>> after;
+  for (auto n : tree) after.emplace_back(n->key, n->data);
+  EXPECT_EQ(before, after);
+  EXPECT_TRUE(std::is_sorted(after.begin(), after.end(), [](auto const &x, auto const &y) { return x.first < y.first; }));
+
+  // the tree keeps working after the compaction, and after repeated ones
+  for (int r = 0; r < 100; ++r) {
+    for (int k = 0; k < 20; ++k) tree.emplace(10000 + 20 * r + k, 2);
+    for (int k = 0; k < 20; ++k) tree.delete_node(10000 + 20 * r + k);
+    tree.compact();
+  }
+  after.clear();
+  for (auto n : tree) after.emplace_back(n->key, n->data);
+  EXPECT_EQ(before, after);
+}
+
+MAKE_MAIN;
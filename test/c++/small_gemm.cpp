@@ -0,0 +1,58 @@
+#include <triqs_cthyb/small_gemm.hpp>
+#include <triqs/test_tools/arrays.hpp>
+#include <cmath>
+
+using nda::range;
+
+// A deterministic matrix with entries of both signs
+template <typename T> nda::matrix<T> make_matrix(long n, long m, int seed) {
+  nda::matrix<T> A(n, m);
+  for (long i = 0; i < n; ++i)
+    for (long j = 0; j < m; ++j) A(i, j) = T(std::sin(1.0 + seed + 0.7 * i - 1.3 * j));
+  return A;
+}
+
+// The kernels for all the inner dimensions up to small_gemm_max_dim, and the BLAS fallback above
+TEST(small_gemm, dimensions) {
+  for (int n = 1; n <= triqs_cthyb::small_gemm_max_dim + 1; ++n) {
+    int k  = triqs_cthyb::small_gemm_max_dim + 2 - n;
+    auto A = make_matrix<double>(n, k, 1), B = make_matrix<double>(k, n, 2);
+    nda::matrix<double> C(n, n), D(k, k);
+    triqs_cthyb::small_gemm(A, B, C);
+    EXPECT_ARRAY_NEAR(C, A * B, 1e-13);
+    triqs_cthyb::small_gemm(B, A, D);
+    EXPECT_ARRAY_NEAR(D, B * A, 1e-13);
+  }
+}
+
+// Views with strided columns are not row-major : BLAS fallback
+TEST(small_gemm, non_contiguous) {
+  auto X = make_matrix<double>(20, 20, 3), Y = make_matrix<double>(20, 20, 4);
+  nda::matrix<double> Z(20, 20);
+  for (int n = 1; n <= 10; ++n) {
+    auto A = X(range(0, n), range(0, 2 * n, 2));
+    auto B = Y(range(1, n + 1), range(0, 2 * n, 2));
+    auto C = Z(range(0, n), range(1, 2 * n + 1, 2));
+    triqs_cthyb::small_gemm(A, B, C);
+    EXPECT_ARRAY_NEAR(nda::matrix<double>{C}, nda::matrix<double>{A} * nda::matrix<double>{B}, 1e-13);
+  }
+}
+
+// Single precision : the kernels, and the plain loop in place of BLAS
+TEST(small_gemm, single_precision) {
+  for (int n = 1; n <= triqs_cthyb::small_gemm_max_dim + 1; ++n) {
+    int k  = triqs_cthyb::small_gemm_max_dim + 2 - n;
+    auto A = make_matrix<double>(n, k, 5), B = make_matrix<double>(k, n, 6);
+    nda::matrix<float> A_f(A), B_f(B), C_f(n, n);
+    triqs_cthyb::small_gemm(A_f, B_f, C_f);
+    EXPECT_ARRAY_NEAR(nda::matrix<double>(C_f), A * B, 1e-5);
+  }
+  auto X = make_matrix<float>(20, 20, 7), Y = make_matrix<float>(20, 20, 8);
+  nda::matrix<float> Z(20, 20);
+  auto A = X(range(0, 8), range(0, 16, 2)), B = Y(range(0, 8), range(1, 17, 2));
+  auto C = Z(range(0, 8), range(0, 16, 2));
+  triqs_cthyb::small_gemm(A, B, C);
+  EXPECT_ARRAY_NEAR(nda::matrix<double>(nda::matrix<float>{C}), nda::matrix<double>(nda::matrix<float>{A}) * nda::matrix<double>(nda::matrix<float>{B}), 1e-5);
+}
+
+MAKE_MAIN;
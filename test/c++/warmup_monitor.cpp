@@ -0,0 +1,42 @@
+#include <triqs_cthyb/warmup_monitor.hpp>
+#include <triqs/test_tools/arrays.hpp>
+#include <cmath>
+#include <random>
+
+using triqs_cthyb::stationarity_monitor;
+
+// Records the sequence f(n) + noise until the monitor finds it stationary.
+// Returns the number of cycles recorded, or -1 if it is not stationary after max_cycles.
+template <typename F> long cycles_to_stationarity(F f, long min_cycles, long max_cycles) {
+  stationarity_monitor monitor(min_cycles);
+  std::mt19937 rng(42);
+  std::normal_distribution<double> noise(0, 1);
+  for (long n = 0; n < max_cycles; ++n) {
+    double x = f(n);
+    if (monitor.record({x + noise(rng), 0.1 * noise(rng), -x + noise(rng)})) return monitor.get_n_cycles();
+  }
+  return -1;
+}
+
+// Noise around a constant : stationary, once min_cycles cycles are recorded
+TEST(warmup_monitor, stationary) {
+  long n = cycles_to_stationarity([](long) { return 5.0; }, 1000, 100000);
+  EXPECT_GE(n, 1000);
+  EXPECT_LT(n, 100000);
+}
+
+// A drift much larger than the noise over the run : never stationary
+TEST(warmup_monitor, drifting) {
+  EXPECT_EQ(cycles_to_stationarity([](long n) { return 0.01 * n; }, 100, 100000), -1);
+  EXPECT_EQ(cycles_to_stationarity([](long n) { return std::sqrt(double(n)); }, 100, 100000), -1);
+}
+
+// A relaxation : stationary only once the second quarter of the run is past the relaxation time
+TEST(warmup_monitor, relaxation) {
+  double tau = 1000;
+  long n     = cycles_to_stationarity([tau](long n) { return 10 * std::exp(-n / tau); }, 100, 1000000);
+  EXPECT_GE(n, 4 * tau);
+  EXPECT_LT(n, 1000000);
+}
+
+MAKE_MAIN;
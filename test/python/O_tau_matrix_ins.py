@@ -0,0 +1,67 @@
+"""
+Sampling of the matrix of density density correlators by operator insertion.
+
+The measure of O_tau_matrix draws the same insertion times from the random
+generator of the chain as the measure of O_tau, so that with the same seed
+O_tau_matrix[0, 1] must equal O_tau for (O_a, O_b). """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+# ----------------------------------------------------------------------
+def solve(**measure):
+
+    solv = Solver(
+        beta = 2.1,
+        gf_struct = [['up',1],['do',1]],
+        n_iw = 30,
+        n_tau = 2*30+1,
+        )
+
+    # -- Weiss field of the impurity
+
+    V1 = 2.0
+    V2 = 5.0
+    epsilon1 = 0.0
+    epsilon2 = 4.0
+    mu = 2.0
+
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu
+                      - V1**2*inverse(iOmega_n - epsilon1)
+                      - V2**2*inverse(iOmega_n - epsilon2)
+                     )
+
+    solv.solve(
+        h_int = 5.0*n('up',0)*n('do',0),
+        move_double = True,
+        length_cycle = 20,
+        n_warmup_cycles = int(1e3),
+        n_cycles = int(1e3),
+        random_seed = 34788 + 928374 * mpi.rank,
+        **measure)
+
+    return solv
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    O_a, O_b = n('up',0), n('do',0)
+
+    O_tau = solve(measure_O_tau = (O_a, O_b)).O_tau
+    O_tau_matrix = solve(measure_O_tau_matrix = [O_a, O_b]).O_tau_matrix
+
+    assert O_tau_matrix.target_shape == (2, 2)
+    np.testing.assert_allclose(O_tau_matrix.data[:, 0, 1], O_tau.data, rtol = 1e-10, atol = 1e-12)
@@ -0,0 +1,107 @@
+"""
+Measure of the static susceptibilities chi_static[a, b] = int dtau <O_a(tau) O_b>.
+
+In the atomic limit, the configurations are empty and chi_static must be
+beta <O_a O_b> from the diagonalization of h_loc. For an Anderson model,
+chi_static[0, 1] must be the integral over tau of O_tau for (O_a, O_b),
+within error bars estimated from independent runs. """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+from triqs.atom_diag import atomic_density_matrix, trace_rho_op
+from h5 import HDFArchive
+
+from triqs.utility.h5diff import h5diff
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+beta = 2.1
+O_a, O_b = n('up',0), n('do',0)
+
+# ----------------------------------------------------------------------
+def atomic_limit():
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['do',1]], n_iw = 30, n_tau = 2*30+1)
+
+    mu = 1.0
+    solv.G0_iw << inverse(iOmega_n + mu)
+
+    solv.solve(
+        h_int = 3.0*n('up',0)*n('do',0),
+        length_cycle = 20,
+        n_warmup_cycles = 10,
+        n_cycles = 100,
+        random_seed = 34788 + 928374 * mpi.rank,
+        measure_chi_static = [O_a, O_b],
+        )
+
+    ad = solv.h_loc_diagonalization
+    rho = atomic_density_matrix(ad, beta)
+    ops = [O_a, O_b]
+    chi_ref = np.array([[beta * trace_rho_op(rho, o1 * o2, ad) for o2 in ops] for o1 in ops])
+    np.testing.assert_allclose(solv.chi_static, chi_ref, rtol = 1e-10, atol = 1e-12)
+
+    return solv.chi_static
+
+# ----------------------------------------------------------------------
+def anderson(random_seed):
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['do',1]], n_iw = 30, n_tau = 2*30+1)
+
+    # -- Weiss field of the impurity, as in O_tau_ins.py
+
+    V1 = 2.0
+    V2 = 5.0
+    epsilon1 = 0.0
+    epsilon2 = 4.0
+    mu = 2.0
+
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu
+                      - V1**2*inverse(iOmega_n - epsilon1)
+                      - V2**2*inverse(iOmega_n - epsilon2)
+                     )
+
+    solv.solve(
+        h_int = 5.0*n('up',0)*n('do',0),
+        move_double = True,
+        length_cycle = 20,
+        n_warmup_cycles = int(1e3),
+        n_cycles = int(1e3),
+        random_seed = random_seed,
+        measure_O_tau = (O_a, O_b),
+        measure_chi_static = [O_a, O_b],
+        )
+
+    # the edge bins of O_tau are averaged : the trapezoidal rule gives the integral of the samples
+    O_tau = solv.O_tau.data.real
+    dtau = beta / (len(O_tau) - 1)
+    return solv.chi_static[0, 1].real, dtau * (np.sum(O_tau) - 0.5 * (O_tau[0] + O_tau[-1]))
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    chi_atomic = atomic_limit()
+
+    n_runs = 5
+    diff = np.array([np.subtract(*anderson(34788 + 928374 * (n_runs * mpi.rank + r))) for r in range(n_runs)])
+    error = np.std(diff, ddof = 1) / np.sqrt(n_runs)
+    assert abs(np.mean(diff)) < 5 * error + 1e-10, "chi_static %g does not match the integral of O_tau, error %g" % (np.mean(diff), error)
+
+    # -- Store results
+
+    if mpi.is_master_node():
+        filename = 'chi_static.out.h5'
+        with HDFArchive(filename, 'w') as res:
+            res['chi_static_atomic'] = chi_atomic.real
+
+        h5diff(filename, 'chi_static.ref.h5')
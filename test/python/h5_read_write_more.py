@@ -36,7 +36,7 @@ if __name__ == '__main__':
 
 
         cf_attr = [
-            'Delta_infty', 'Delta_tau', 'G0_iw', 'G2_iw', 'G2_iw_nfft', 'G2_iw_ph', 'G2_iw_ph_nfft', 'G2_iw_pp', 'G2_iw_pp_nfft', 'G2_iwll_ph', 'G2_iwll_pp', 'G2_tau', 'G_l', 'G_tau', 'G_tau_accum', 'O_tau', 'average_sign', 'constr_parameters', 'density_matrix', 'h_loc', 'last_constr_parameters', 'last_solve_parameters', 'performance_analysis', 'solve_parameters'
+            'Delta_infty', 'Delta_tau', 'G0_iw', 'G2_iw', 'G2_iw_nfft', 'G2_iw_ph', 'G2_iw_ph_nfft', 'G2_iw_pp', 'G2_iw_pp_nfft', 'G2_iwll_ph', 'G2_iwll_pp', 'G2_tau', 'G_l', 'G_tau', 'G_tau_accum', 'O_tau', 'O_tau_matrix', 'average_sign', 'chi_static', 'constr_parameters', 'density_matrix', 'h_loc', 'last_constr_parameters', 'last_solve_parameters', 'performance_analysis', 'solve_parameters', 'tuned_length_cycle', 'tuned_proposal_prob'
             ]
 
         success = True
@@ -0,0 +1,67 @@
+#!/bin/env python
+
+"""
+Local insertion and removal moves, for one and two pairs of operators.
+
+The model and the parameters of histograms.py, with local_move_window set:
+the Markov chain differs, but the distributions of the perturbation order
+must match the ones of histograms.ref.h5 within the statistical errors. """
+
+import triqs.utility.mpi as mpi
+from h5 import HDFArchive
+from triqs.operators import *
+from triqs_cthyb import *
+from triqs.gf import *
+import numpy as np
+
+spin_names = ("up","dn")
+gf_struct = [["dn",1], ["up",1]]
+
+# Input parameters
+beta = 10.0
+U = 2.0
+mu = 1.0
+V = 1.0
+epsilon = 2.3
+
+n_iw = 1025
+n_tau = 10001
+
+p = {}
+p["max_time"] = -1
+p["random_name"] = ""
+p["random_seed"] = 123 * mpi.rank + 567
+p["length_cycle"] = 50
+p["n_warmup_cycles"] = 5000
+p["n_cycles"] = 50000
+p["move_shift"] = True
+p["move_double"] = True
+p["local_move_window"] = 2.0
+p["measure_pert_order"] = True
+
+H = U*n("up",0)*n("dn",0) -mu*(n("up",0) + n("dn",0))
+
+# Construct the solver
+S = SolverCore(beta=beta, gf_struct=gf_struct, n_tau=n_tau, n_iw=n_iw)
+
+# Set hybridization function
+delta_w = GfImFreq(indices = [0], beta=beta)
+delta_w << (V**2)*(inverse(iOmega_n - epsilon) + inverse(iOmega_n + epsilon))
+for sn in spin_names: S.G0_iw[sn] << inverse(iOmega_n - delta_w)
+
+# Solve the problem
+S.solve(h_int=H, **p)
+
+def assert_distributions_are_close(hi1, hi2):
+    assert hi1.limits == hi2.limits
+    np.testing.assert_allclose(hi1.data / hi1.n_data_pts, hi2.data / hi2.n_data_pts, atol = 0.01)
+
+if mpi.is_master_node():
+    with HDFArchive('local_moves.out.h5','w') as ar:
+        ar['perturbation_order'] = S.perturbation_order
+        ar['perturbation_order_total'] = S.perturbation_order_total
+
+    with HDFArchive('histograms.ref.h5','r') as ar:
+        assert_distributions_are_close(ar['perturbation_order_total'], S.perturbation_order_total)
+        for block, h in ar['perturbation_order'].items():
+            assert_distributions_are_close(h, S.perturbation_order[block])
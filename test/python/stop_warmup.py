@@ -0,0 +1,90 @@
+"""
+Early stop of the warmup with stop_warmup_when_stationary.
+
+The warmup of the Anderson model is stationary after a few thousand cycles :
+it must stop well before n_warmup_cycles, as reported in the output of the
+solver, and the solve must still end with solve_status 0. Its G_tau must agree
+with the one of a standard run. """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+import os, re, sys, tempfile
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+beta = 10.0
+n_tau = 201
+
+# ----------------------------------------------------------------------
+def solve(**params):
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['dn',1]], n_iw = 200, n_tau = n_tau)
+
+    # -- The Anderson model of test/c++/anderson.cpp
+
+    U = 2.0
+    mu = 1.0
+    V = 1.0
+    epsilon = 2.3
+
+    delta_w = GfImFreq(indices = [0], beta = beta)
+    delta_w << V**2 * (inverse(iOmega_n - epsilon) + inverse(iOmega_n + epsilon))
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu - delta_w)
+
+    solv.solve(
+        h_int = U*n('up',0)*n('dn',0),
+        length_cycle = 50,
+        n_cycles = 20000,
+        random_seed = 34788 + 928374 * mpi.rank,
+        **params)
+
+    return solv
+
+# ----------------------------------------------------------------------
+def solve_with_output(**params):
+
+    # The solver writes to the C++ std::cout : redirect the file descriptor
+    with tempfile.TemporaryFile(mode = 'w+') as f:
+        sys.stdout.flush()
+        stdout_fd = os.dup(1)
+        os.dup2(f.fileno(), 1)
+        try:
+            solv = solve(**params)
+        finally:
+            os.dup2(stdout_fd, 1)
+            os.close(stdout_fd)
+        f.seek(0)
+        output = f.read()
+    sys.stdout.write(output)
+    return solv, output
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    ref = solve(n_warmup_cycles = 1000)
+    assert ref.solve_status == 0
+
+    # the monitor decides after at least n_warmup_cycles / 10 cycles
+    n_warmup_cycles = 100000
+    solv, output = solve_with_output(n_warmup_cycles = n_warmup_cycles, stop_warmup_when_stationary = True, verbosity = 2)
+    assert solv.solve_status == 0, "early stop of the warmup : solve_status %d" % solv.solve_status
+
+    stop = re.search(r"Warmup stopped after (\d+) cycles", output)
+    assert stop is not None, "the warmup did not stop before n_warmup_cycles"
+    assert int(stop.group(1)) < n_warmup_cycles, "the warmup stopped after %s cycles" % stop.group(1)
+
+    # G_tau averaged over bins of 10 tau points
+    coarse = lambda g : g.data[:n_tau - 1, 0, 0].real.reshape(-1, 10).mean(axis = 1)
+    for name, g in solv.G_tau:
+        np.testing.assert_allclose(coarse(g), coarse(ref.G_tau[name]), atol = 0.02)
@@ -0,0 +1,73 @@
+"""
+Trace estimator as the Monte Carlo weight.
+
+With use_trace_estimator, the weight is the trace of the dominant block and
+the full trace enters through the reweighting of the measures: G_tau and
+the densities must agree with the ones of the standard run, within error
+bars estimated from independent runs. """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+beta = 10.0
+n_tau = 201
+
+# ----------------------------------------------------------------------
+def solve(random_seed, **params):
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['dn',1]], n_iw = 200, n_tau = n_tau)
+
+    # -- The Anderson model of test/c++/anderson.cpp, with a field
+
+    U = 2.0
+    mu = 1.0
+    h = 0.2
+    V = 1.0
+    epsilon = 2.3
+
+    delta_w = GfImFreq(indices = [0], beta = beta)
+    delta_w << V**2 * (inverse(iOmega_n - epsilon) + inverse(iOmega_n + epsilon))
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu - delta_w)
+
+    solv.solve(
+        h_int = U*n('up',0)*n('dn',0) + h*(n('up',0) - n('dn',0)),
+        length_cycle = 50,
+        n_warmup_cycles = 1000,
+        n_cycles = 10000,
+        random_seed = random_seed,
+        **params)
+
+    # G_tau averaged over bins of 10 tau points, and the densities -G(beta)
+    res = []
+    for name, g in solv.G_tau:
+        res += list(g.data[:n_tau - 1, 0, 0].real.reshape(-1, 10).mean(axis = 1))
+        res.append(-g.data[-1, 0, 0].real)
+    return np.array(res)
+
+# ----------------------------------------------------------------------
+def mean_and_error(**params):
+    n_runs = 4
+    runs = np.array([solve(34788 + 928374 * (n_runs * mpi.rank + r), **params) for r in range(n_runs)])
+    return runs.mean(axis = 0), runs.std(axis = 0, ddof = 1) / np.sqrt(n_runs)
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    ref, ref_error = mean_and_error()
+    est, est_error = mean_and_error(use_trace_estimator = True)
+
+    error = np.sqrt(ref_error**2 + est_error**2)
+    assert np.all(np.abs(est - ref) < 5 * error + 1e-3), "use_trace_estimator : max deviation %g error bars" % np.max(np.abs(est - ref) / error)
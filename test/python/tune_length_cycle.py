@@ -0,0 +1,82 @@
+"""
+Tuning of the length of the cycles of the accumulation.
+
+With tune_length_cycle, the length of the cycles is set at the end of the
+warmup from the auto-correlation time of the perturbation order, within
+[1, 10 length_cycle]. G_tau and the densities must agree with the ones of an
+untuned run, within error bars estimated from independent runs. """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+beta = 10.0
+n_tau = 201
+
+# ----------------------------------------------------------------------
+def solve(random_seed, length_cycle, **params):
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['dn',1]], n_iw = 200, n_tau = n_tau)
+
+    # -- The Anderson model of test/c++/anderson.cpp, with a field
+
+    U = 2.0
+    mu = 1.0
+    h = 0.2
+    V = 1.0
+    epsilon = 2.3
+
+    delta_w = GfImFreq(indices = [0], beta = beta)
+    delta_w << V**2 * (inverse(iOmega_n - epsilon) + inverse(iOmega_n + epsilon))
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu - delta_w)
+
+    solv.solve(
+        h_int = U*n('up',0)*n('dn',0) + h*(n('up',0) - n('dn',0)),
+        length_cycle = length_cycle,
+        n_warmup_cycles = 50000 // length_cycle, # the same number of warmup moves
+        n_cycles = 10000,
+        random_seed = random_seed,
+        **params)
+
+    tuned = solv.tuned_length_cycle
+    if params.get('tune_length_cycle', False):
+        assert 1 <= tuned <= 10 * length_cycle, "tuned_length_cycle %d not in [1, %d]" % (tuned, 10 * length_cycle)
+    else:
+        assert tuned == 0, "tuned_length_cycle %d without tune_length_cycle" % tuned
+
+    # G_tau averaged over bins of 10 tau points, and the densities -G(beta)
+    res = []
+    for name, g in solv.G_tau:
+        res += list(g.data[:n_tau - 1, 0, 0].real.reshape(-1, 10).mean(axis = 1))
+        res.append(-g.data[-1, 0, 0].real)
+    return np.array(res)
+
+# ----------------------------------------------------------------------
+def mean_and_error(length_cycle, **params):
+    n_runs = 4
+    runs = np.array([solve(34788 + 928374 * (n_runs * mpi.rank + r), length_cycle, **params) for r in range(n_runs)])
+    return runs.mean(axis = 0), runs.std(axis = 0, ddof = 1) / np.sqrt(n_runs)
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    ref, ref_error = mean_and_error(50)
+
+    # with length_cycle = 2, the auto-correlation time is likely above the limit of 20 moves
+    for length_cycle in [50, 2]:
+        tuned, tuned_error = mean_and_error(length_cycle, tune_length_cycle = True)
+        error = np.sqrt(ref_error**2 + tuned_error**2)
+        assert np.all(np.abs(tuned - ref) < 5 * error + 1e-3), \
+            "tune_length_cycle, length_cycle %d : max deviation %g error bars" % (length_cycle, np.max(np.abs(tuned - ref) / error))
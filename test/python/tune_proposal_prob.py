@@ -0,0 +1,89 @@
+"""
+Tuning of the proposal probabilities of the blocks.
+
+With tune_proposal_prob, the probabilities of the blocks in the insertions
+and removals of a pair of operators are tuned during the warmup, starting
+from proposal_prob. The tuned probabilities must be normalized as the priors,
+and G_tau and the densities must agree with the ones of an untuned run, within
+error bars estimated from independent runs. """
+
+# ----------------------------------------------------------------------
+
+import numpy as np
+
+# ----------------------------------------------------------------------
+
+from triqs.gf import *
+from triqs.operators import *
+
+import triqs.utility.mpi as mpi
+
+# ----------------------------------------------------------------------
+
+from triqs_cthyb import Solver
+
+beta = 10.0
+n_tau = 201
+proposal_prob = {'up' : 1.0, 'dn' : 0.5}
+
+# ----------------------------------------------------------------------
+def solve(random_seed, **params):
+
+    solv = Solver(beta = beta, gf_struct = [['up',1],['dn',1]], n_iw = 200, n_tau = n_tau)
+
+    # -- The Anderson model of test/c++/anderson.cpp, with a field : the blocks differ
+
+    U = 2.0
+    mu = 1.0
+    h = 0.3
+    V = 1.0
+    epsilon = 2.3
+
+    delta_w = GfImFreq(indices = [0], beta = beta)
+    delta_w << V**2 * (inverse(iOmega_n - epsilon) + inverse(iOmega_n + epsilon))
+    for name, g0 in solv.G0_iw:
+        g0 << inverse(iOmega_n + mu - delta_w)
+
+    solv.solve(
+        h_int = U*n('up',0)*n('dn',0) + h*(n('up',0) - n('dn',0)),
+        length_cycle = 50,
+        n_warmup_cycles = 1000,
+        n_cycles = 10000,
+        random_seed = random_seed,
+        proposal_prob = proposal_prob,
+        **params)
+
+    # G_tau averaged over bins of 10 tau points, and the densities -G(beta)
+    res = []
+    for name, g in solv.G_tau:
+        res += list(g.data[:n_tau - 1, 0, 0].real.reshape(-1, 10).mean(axis = 1))
+        res.append(-g.data[-1, 0, 0].real)
+    return np.array(res), solv.tuned_proposal_prob
+
+# ----------------------------------------------------------------------
+def mean_and_error(**params):
+    n_runs = 4
+    runs = [solve(34788 + 928374 * (n_runs * mpi.rank + r), **params) for r in range(n_runs)]
+    res = np.array([r[0] for r in runs])
+    return res.mean(axis = 0), res.std(axis = 0, ddof = 1) / np.sqrt(n_runs), [r[1] for r in runs]
+
+# ----------------------------------------------------------------------
+if __name__ == '__main__':
+
+    ref, ref_error, untuned_probs = mean_and_error()
+    tuned, tuned_error, tuned_probs = mean_and_error(tune_proposal_prob = True)
+
+    # -- The tuned probabilities, normalized as proposal_prob
+
+    assert all(len(p) == 0 for p in untuned_probs), "tuned_proposal_prob without tune_proposal_prob"
+    for p in tuned_probs:
+        assert sorted(p.keys()) == sorted(proposal_prob.keys()), "tuned_proposal_prob : blocks %s" % list(p.keys())
+        assert abs(sum(p.values()) - sum(proposal_prob.values())) < 1e-10, "tuned_proposal_prob %s not normalized as %s" % (p, proposal_prob)
+        # at least a tenth of the prior, relative to the best block
+        ratios = np.array([p[b] / proposal_prob[b] for b in proposal_prob])
+        assert np.all(ratios > 0) and np.min(ratios) >= 0.1 * np.max(ratios) - 1e-10, "tuned_proposal_prob %s" % p
+
+    # -- The observables
+
+    error = np.sqrt(ref_error**2 + tuned_error**2)
+    assert np.all(np.abs(tuned - ref) < 5 * error + 1e-3), "tune_proposal_prob : max deviation %g error bars" % np.max(np.abs(tuned - ref) / error)